@@ -4,40 +4,980 @@
 
 
 /* Including necessary header files*/
+#define _GNU_SOURCE                 /* accept4() and other Linux extensions*/
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <limits.h>
 #include <ctype.h>
 #include <string.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/perf_event.h>
+#include <sched.h>
 
 /* Definitions of constants*/
-#define MAX_CAPACITY 5000           /* Maximum capacity of each heap*/
+#define INITIAL_CAPACITY 64         /* Initial capacity of each heap, the array grows on demand*/
 #define ROOT 0                      /* Root index in the heap*/
-#define MAX_LINE_LENGTH 30000       /* Maximum length of a line read from a file*/
-#define MAX_HEAPS 10                /* Maximum number of heaps*/
+#define OUTPUT_BUFFER_SIZE (1 << 16) /* Bytes collected by an OutputBuffer before they are written*/
+#define CHUNKS_PER_THREAD 4         /* Input chunks per ingestion thread, so fast threads pick up more work*/
+#define MIN_CHUNK_SIZE (1 << 16)    /* Inputs are not split into chunks smaller than this many bytes*/
 #define MAX_FILENAME_LENGTH 260     /* Maximum length of the filename*/
+#define SCRIPT_BUFFER_SIZE (1 << 20) /* Bytes of an operations script read at a time, and its longest line*/
+#define PROTOCOL_BUFFER_SIZE (1 << 20) /* Bytes of binary requests read at a time*/
+#define PROTOCOL_MAX_FRAME 4096     /* Largest request frame accepted, longer ones end the session*/
+#define CONNECTION_BUFFER_SIZE (1 << 16) /* Bytes of requests buffered per server connection*/
+#define MAX_EVENTS 64               /* Events handled per epoll_wait() call*/
+#define MAX_THREADS 256             /* Most threads a concurrent heap can serve*/
+#define CACHE_LINE 64               /* Bytes per cache line, to keep per-thread data apart*/
+#define HUNT_CAPACITY (1 << 22)     /* Nodes of a fine-grained locked heap, which cannot grow*/
+#define HUNT_SPINS 64               /* Failed attempts before a waiting thread sleeps*/
+#define HUNT_EMPTY 0                /* Tag of a node holding no key*/
+#define HUNT_AVAILABLE 1            /* Tag of a node holding a key in its final place*/
+#define HUNT_OWNER(thread) ((thread) + 2) /* Tag of a node holding a key that thread is still moving up*/
+#define STEAL_BATCH 32              /* Most keys a thief takes from another thread's heap at once*/
+#define RING_SIZE 1024              /* Keys a producer ring holds, a power of two*/
+#define WAIT_FOREVER -1             /* Timeout of a blocking extract that waits as long as it takes*/
+#define QUEUES_PER_THREAD 2         /* Heaps per thread in a MultiQueue, the c in c*P*/
+#define RANK_KEY_BITS 20            /* Keys of the rank error measurement are below 2^RANK_KEY_BITS*/
+
+#define INDEX_FILE_MAGIC "DHEAPIDX" /* First 8 bytes of a line offset index file*/
+#define INDEX_FILE_SUFFIX ".idx"    /* Suffix appended to an input file name to get its index file name*/
+#define HEAP_FILE_MAGIC "DARYHEAP"  /* First 8 bytes of a binary heap file*/
+#define HEAP_FILE_VERSION 1         /* Version of the binary heap file format*/
+#define HEAP_UNORDERED 0            /* The keys in a heap file are in no particular order*/
+#define HEAP_MAX_ORDERED 1          /* The keys in a heap file already form a valid max-heap*/
+#define TRACE_FILE_MAGIC "DHEAPTRC" /* First 8 bytes of an operation trace*/
+#define TRACE_FILE_VERSION 1        /* Version of the operation trace format*/
+#define TRACE_BUFFER_SIZE (1 << 16) /* Bytes of trace records buffered before they are written*/
+#define WAL_SYNC_MS 10              /* Default milliseconds a write-ahead log record may wait for its sync*/
+#define WAL_CHECKPOINT_BYTES (64 << 20) /* Bytes of records after which a write-ahead log larger than its snapshot is checkpointed*/
+#define SNAPSHOT_CHUNK (1 << 20)    /* Keys a background snapshot writes between two progress updates*/
+#define SNAPSHOT_KEEP 2             /* Default number of older background snapshots kept*/
+#define SHARED_HEAP_MAGIC "DHEAPSHM" /* First 8 bytes of a shared-memory heap segment*/
+#define SHARED_HEAP_VERSION 1       /* Version of the shared-memory heap layout*/
+#define SHARED_HEAP_CAPACITY (1 << 20) /* Default number of keys a shared-memory heap holds*/
+#define BENCH_OPERATIONS 100000     /* Operations timed per benchmark measurement*/
+#define ADAPT_WINDOW 65536          /* Operations between two degree decisions of an adaptive batch run*/
+#define ADAPT_GAIN 0.8              /* An adaptive batch run changes d only if the model cost drops below this share*/
+#define FEW_UNIQUE_KEYS 16          /* Distinct keys of the few-unique benchmark distribution*/
+#define LATENCY_SUB_BITS 4          /* Linear sub-buckets per power of two are 2^LATENCY_SUB_BITS*/
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BITS) /* Linear sub-buckets per power of two*/
+#define LATENCY_BUCKETS ((64 - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS) /* Buckets covering all 64-bit latencies*/
+#define PERF_EVENTS 4               /* Hardware events counted by the benchmark: cycles, instructions, cache and branch misses*/
+#define LATENCY_OPS "ixkd"          /* Script operations whose latency is recorded, one histogram each*/
+#define GEN_KEY_RANGE (1 << 30)     /* Keys of the uniform workload are below this*/
+#define GEN_KEY_BASE (INT_MAX / 2)  /* Largest starting key of the hold and monotone workloads, which only go down*/
+
+/* Per-heap operation counters, compiled in with -DHEAP_STATS and free otherwise*/
+#ifdef HEAP_STATS
+#define HEAP_COUNT(heap, counter, n) ((heap)->stats.counter += (n))
+#else
+#define HEAP_COUNT(heap, counter, n) ((void)0)
+#endif
+
+/* Where the array of a heap lives*/
+typedef enum {
+    HEAP_STORAGE_MALLOC,      /* Array allocated with malloc*/
+    HEAP_STORAGE_FILE,        /* Array mapped in place from a binary heap file*/
+    HEAP_STORAGE_PRIVATE_MAP, /* Array mapped copy-on-write from a raw key or heap file, changes stay in memory*/
+    HEAP_STORAGE_SHARED       /* Array in a shared-memory segment owned by a SharedHeap, it cannot grow*/
+} HeapStorage;
+
+/* Header of a binary heap file, followed by capacity native-endian int32 keys*/
+typedef struct {
+    char magic[8];            /* HEAP_FILE_MAGIC*/
+    int32_t version;          /* HEAP_FILE_VERSION*/
+    int32_t d;                /* Degree of the heap*/
+    int32_t size;             /* Number of keys in use*/
+    int32_t capacity;         /* Number of key slots in the file*/
+    int32_t ordering;         /* HEAP_UNORDERED or HEAP_MAX_ORDERED*/
+    int32_t reserved;         /* Padding, always 0*/
+} HeapFileHeader;
+
+/* Header of an operation trace, followed by records of one operation byte and its native-endian
+ * int32 arguments: 'i' KEY, 'x', 'k' INDEX KEY, 'd' INDEX, 'm' COUNT KEY... (insertMany) and,
+ * first, 'l' COUNT KEY... holding the keys of the heap when the trace started, in heap order*/
+typedef struct {
+    char magic[8];            /* TRACE_FILE_MAGIC*/
+    int32_t version;          /* TRACE_FILE_VERSION*/
+    int32_t d;                /* Degree of the heap when the trace started*/
+} TraceFileHeader;
+
+/* Contents of an input file, mapped or read into memory*/
+typedef struct {
+    const char *data;         /* First byte of the file*/
+    size_t length;            /* Length of the file in bytes*/
+    int mapped;               /* 1 if data is an mmap of the file, 0 if it was read into a malloc buffer*/
+} InputFile;
+
+#ifdef HEAP_STATS
+/* What the operations on one heap did, since the heap was created or resetHeapStats()*/
+typedef struct {
+    long long comparisons;    /* Key comparisons*/
+    long long moves;          /* Keys written to the array*/
+    long long siftUpLevels;   /* Levels keys moved up*/
+    long long siftDownLevels; /* Levels keys moved down*/
+    long long inserts;        /* Keys inserted, one by one or in bulk*/
+    long long extracts;       /* Maximums extracted*/
+    long long increases;      /* Keys increased*/
+    long long deletes;        /* Keys deleted*/
+    long long builds;         /* Calls to buildMaxHeap()*/
+} HeapStats;
+#endif
+
+/* Write-ahead log of a heap: a trace that starts with a snapshot of the keys and whose records
+ * are made durable with fdatasync(), at most syncInterval after they were written*/
+typedef struct {
+    char fileName[MAX_FILENAME_LENGTH + 16]; /* Name of the log*/
+    uint64_t syncInterval;    /* Nanoseconds a record may wait for its sync, 0 to sync every record*/
+    uint64_t lastSync;        /* When the log was last synced, on the coarse monotonic clock*/
+    int dirty;                /* 1 if records were written since the last sync*/
+    long syncs;               /* Syncs done*/
+    uint64_t appended;        /* Bytes of records written since the last checkpoint*/
+} HeapLog;
 
 /* Structure defining a Heap*/
 typedef struct {
-    int array[MAX_CAPACITY];  /* Array to store heap elements*/
+    int *array;               /* Array to store heap elements*/
     int size;                 /* Current number of elements in the heap*/
+    int capacity;             /* Number of elements the array can hold*/
     int d;                    /* Degree of the heap*/
+    HeapStorage storage;      /* Where the array lives*/
+    HeapFileHeader *header;   /* Header of the mapped heap file, shared or private, NULL for other storage*/
+    size_t mappedLength;      /* Length of the mapping in bytes, 0 for malloc storage*/
+    int fd;                   /* Descriptor of the mapped heap file, -1 for other storage*/
+    int changedFrom;          /* Lowest index changed since resetChanges(), INT_MAX if none*/
+    int changedTo;            /* Highest index changed since resetChanges(), -1 if none*/
+    FILE *trace;              /* Where the operations are recorded, NULL if they are not, see startTrace()*/
+    HeapLog *log;             /* Write-ahead log the trace belongs to, NULL for a plain trace, see startHeapLog()*/
+#ifdef HEAP_STATS
+    HeapStats stats;          /* Operation counters*/
+#endif
 } Heap;
 
+/* Output collected in memory and written with as few write() calls as possible*/
+typedef struct {
+    char data[OUTPUT_BUFFER_SIZE];  /* Bytes not written yet*/
+    size_t length;                  /* Number of bytes in data*/
+    int fd;                         /* Descriptor the bytes are written to*/
+} OutputBuffer;
+
+/* One newline-aligned piece of an input file, parsed by one ingestion thread*/
+typedef struct {
+    const char *begin;        /* First byte of the chunk, at the start of a line*/
+    const char *end;          /* One past the last byte of the chunk, just after a newline or at the end of the file*/
+    Heap *heaps;              /* Heaps parsed from the chunk, one per non-empty line*/
+    int numHeaps;             /* Number of heaps parsed*/
+    int capacity;             /* Number of heaps the heaps array can hold*/
+    long lines;               /* Number of lines parsed, including blank ones*/
+    int error;                /* 1 if parsing stopped at an invalid number on line number lines*/
+} IngestChunk;
+
+/* Work shared by the ingestion threads*/
+typedef struct {
+    IngestChunk *chunks;      /* Chunks of the input file*/
+    int numChunks;            /* Number of chunks*/
+    atomic_int nextChunk;     /* Index of the next chunk to hand out*/
+    int d;                    /* Degree to build the heaps with, 0 to leave them unordered*/
+} IngestJob;
+
+/* Header of a line offset index file, followed by numHeaps uint64 offsets*/
+typedef struct {
+    char magic[8];            /* INDEX_FILE_MAGIC*/
+    int64_t fileSize;         /* Size of the indexed input file*/
+    int64_t modifiedSeconds;  /* Modification time of the indexed input file*/
+    int64_t modifiedNanoseconds;
+    int64_t numHeaps;         /* Number of offsets that follow*/
+} IndexFileHeader;
+
+/* Line offsets of a text input file, so single heaps can be parsed when first accessed*/
+typedef struct {
+    InputFile input;          /* The mapped input file*/
+    uint64_t *offsets;        /* Offset of the first byte of every non-empty line*/
+    int numHeaps;             /* Number of non-empty lines*/
+    Heap *heaps;              /* heaps[i] is valid once loaded[i] is set*/
+    char *loaded;             /* 1 for every heap parsed so far*/
+} HeapIndex;
+
+/* Counts of the operations executed by a batch script*/
+typedef struct {
+    long inserts;             /* Keys inserted*/
+    long extracts;            /* Maximums extracted*/
+    long emptyExtracts;       /* Extracts skipped because the heap was empty*/
+    long increases;           /* Keys increased*/
+    long deletes;             /* Keys deleted*/
+    long prints;              /* Times the heap was printed*/
+    long checksum;            /* Sum of the extracted keys, to compare runs*/
+} BatchStats;
+
+/* Log-linear histogram of latencies: exact below LATENCY_SUB_BUCKETS ns, then
+ * LATENCY_SUB_BUCKETS buckets per power of two, so every value is within 1/16 of its bucket*/
+typedef struct {
+    long long counts[LATENCY_BUCKETS]; /* Latencies recorded per bucket*/
+    long long total;          /* Latencies recorded*/
+    uint64_t max;             /* Largest latency recorded, in nanoseconds*/
+} LatencyHistogram;
+
+/* Latency histograms of the operations of a batch script*/
+typedef struct {
+    LatencyHistogram histograms[sizeof(LATENCY_OPS) - 1]; /* One per operation of LATENCY_OPS*/
+    int sampleEvery;          /* Time one operation in this many of each kind*/
+    int countdown[sizeof(LATENCY_OPS) - 1]; /* Operations of each kind left until the next timed one*/
+} LatencyRecorder;
+
+/* Operations of the binary protocol*/
+typedef enum {
+    OP_INSERT = 1,            /* Insert key*/
+    OP_EXTRACT_MAX = 2,       /* Extract the maximum, returned in value*/
+    OP_INCREASE_KEY = 3,      /* Increase the key at index to key*/
+    OP_DELETE = 4,            /* Delete the key at index*/
+    OP_MAX = 5,               /* Return the maximum without removing it*/
+    OP_SIZE = 6,              /* Return the size only*/
+    OP_CREATE = 7,            /* Create an empty heap with degree key, its id is returned in heapId*/
+    OP_SNAPSHOT = 8,          /* Start saving the heap in the background*/
+    OP_SNAPSHOT_STATUS = 9    /* Report the last background snapshot: its heap, keys written in value and keys in size*/
+} ProtocolOpcode;
+
+/* Result of a binary protocol request*/
+typedef enum {
+    STATUS_OK = 0,
+    STATUS_EMPTY = 1,         /* The heap is empty*/
+    STATUS_BAD_HEAP = 2,      /* No heap has this id*/
+    STATUS_BAD_INDEX = 3,     /* The index is out of bounds*/
+    STATUS_BAD_KEY = 4,       /* The new key is smaller than the current key, or the degree is below 1*/
+    STATUS_BAD_OPCODE = 5,    /* Unknown opcode, or a snapshot without a snapshot prefix*/
+    STATUS_BAD_REQUEST = 6,   /* The frame is too short to hold a request*/
+    STATUS_BUSY = 7,          /* A background snapshot is still running*/
+    STATUS_FAILED = 8         /* The background snapshot could not be started or written*/
+} ProtocolStatus;
+
+/* Body of a request frame; every frame is a uint32 length followed by that many bytes*/
+typedef struct {
+    uint8_t opcode;           /* ProtocolOpcode*/
+    uint8_t flags;            /* Reserved, 0*/
+    uint16_t reserved;        /* Reserved, 0*/
+    uint32_t heapId;          /* Heap to operate on*/
+    int32_t key;              /* Key for insert and increase key, degree for create*/
+    int32_t index;            /* Index for increase key and delete*/
+} ProtocolRequest;
+
+/* Body of a response frame, sent as a uint32 length followed by this structure*/
+typedef struct {
+    uint8_t status;           /* ProtocolStatus*/
+    uint8_t opcode;           /* Opcode of the request*/
+    uint16_t reserved;        /* Reserved, 0*/
+    uint32_t heapId;          /* Heap of the request, or the new heap for create*/
+    int32_t value;            /* Extracted or maximum key*/
+    int32_t size;             /* Size of the heap after the request*/
+} ProtocolResponse;
+
+/* States of a background snapshot*/
+typedef enum {
+    SNAPSHOT_NONE = 0,        /* No snapshot was started*/
+    SNAPSHOT_RUNNING = 1,     /* The child is still writing*/
+    SNAPSHOT_DONE = 2,        /* The snapshot was written and renamed into place*/
+    SNAPSHOT_FAILED = 3       /* The child could not be created, failed or was killed*/
+} SnapshotState;
+
+/* Progress of a background snapshot, in memory shared with the child that writes it*/
+typedef struct {
+    atomic_long written;      /* Keys written so far*/
+    long total;               /* Keys in the snapshot*/
+} SnapshotProgress;
+
+/* A heap file written by a forked child while the parent keeps serving requests*/
+typedef struct {
+    SnapshotProgress *progress; /* Anonymous shared mapping, NULL until the first snapshot*/
+    SnapshotState state;      /* State of the last snapshot*/
+    pid_t pid;                /* The child writing the snapshot, 0 when none is running*/
+    int heapId;               /* Heap of the last snapshot*/
+} BackgroundSnapshot;
+
+/* Heaps served over the binary protocol, addressed by their position*/
+typedef struct {
+    Heap *heaps;              /* The heaps*/
+    int numHeaps;             /* Number of heaps*/
+    int capacity;             /* Number of heaps the array can hold*/
+    const char *tracePrefix;  /* Heap N records its operations to tracePrefix.N, NULL if they are not recorded*/
+    long logSyncMs;           /* -1 if the records are plain traces, else write-ahead logs synced this often*/
+    const char *snapshotPrefix; /* Heap N is saved in the background to snapshotPrefix.N, NULL if it cannot be*/
+    int snapshotKeep;         /* Older snapshots kept as snapshotPrefix.N.1 (the newest) and up*/
+    BackgroundSnapshot snapshot; /* The last background snapshot*/
+} HeapTable;
+
+/* One client of the socket server*/
+typedef struct {
+    int fd;                   /* Connected socket*/
+    char in[CONNECTION_BUFFER_SIZE]; /* Received bytes not processed yet*/
+    size_t inLength;          /* Number of bytes in in*/
+    OutputBuffer out;         /* Responses not sent yet*/
+    size_t outSent;           /* Bytes of out already sent*/
+} Connection;
+
+/* Settings and results of one load generator connection*/
+typedef struct {
+    const char *socketName;   /* Path of the server socket*/
+    int requests;             /* Requests to send*/
+    int pipeline;             /* Requests sent per write*/
+    int d;                    /* Degree of the heap the connection creates*/
+    uint64_t seed;            /* Seed of the key generator*/
+    uint64_t *latencies;      /* Latency of every request in nanoseconds*/
+    int errors;               /* Responses with an unexpected status*/
+} LoadClient;
+
+/* State of a flat combining publication slot*/
+typedef enum {
+    FC_IDLE,                  /* No request*/
+    FC_INSERT,                /* Insert key*/
+    FC_EXTRACT,               /* Extract the maximum into key*/
+    FC_DONE                   /* The combiner applied the request*/
+} CombiningState;
+
+/* Publication slot of one thread, on a cache line of its own*/
+typedef struct {
+    _Alignas(CACHE_LINE) atomic_int state; /* CombiningState*/
+    int key;                  /* Key to insert, or the extracted key*/
+    int found;                /* 1 if an extract found a key*/
+} CombiningSlot;
+
+/* Heap shared by threads through flat combining: threads publish requests in their slots and
+   whichever thread takes the lock applies all pending requests to the heap in one pass*/
+typedef struct {
+    Heap heap;                /* The heap, only touched by the lock holder*/
+    pthread_mutex_t lock;     /* Held by the current combiner*/
+    CombiningSlot slots[MAX_THREADS]; /* One slot per thread*/
+    int numThreads;           /* Number of slots in use*/
+    int keys[MAX_THREADS];    /* Scratch space of the combiner*/
+    int extractors[MAX_THREADS]; /* Scratch space of the combiner*/
+} CombiningHeap;
+
+/* Heap shared by threads behind a single mutex*/
+typedef struct {
+    Heap heap;                /* The heap*/
+    pthread_mutex_t lock;     /* Protects heap*/
+} LockedHeap;
+
+/* One heap of a MultiQueue with its try-lock and a cached view of its maximum*/
+typedef struct {
+    _Alignas(CACHE_LINE) atomic_int locked; /* 1 while a thread works on the heap*/
+    atomic_int size;          /* Size of the heap, readable without the lock*/
+    atomic_int top;           /* Maximum of the heap when size > 0, readable without the lock*/
+    Heap heap;                /* The heap*/
+} MultiQueueShard;
+
+/* Random state of one MultiQueue thread, on a cache line of its own*/
+typedef struct {
+    _Alignas(CACHE_LINE) uint64_t seed;
+} MultiQueueThread;
+
+/* Relaxed concurrent priority queue: c*P independent heaps. Inserts go to a random heap and
+   extracts take the better maximum of two random heaps, so the extracted key is only close
+   to the global maximum but threads rarely meet on the same lock*/
+typedef struct {
+    MultiQueueShard *queues;  /* The heaps*/
+    int numQueues;            /* Number of heaps*/
+    MultiQueueThread threads[MAX_THREADS]; /* Per-thread random state*/
+} MultiQueue;
+
+/* Node of a fine-grained locked heap*/
+typedef struct {
+    atomic_int lock;          /* Spin lock of the node*/
+    int tag;                  /* HUNT_EMPTY, HUNT_AVAILABLE or HUNT_OWNER of the inserting thread*/
+    int key;                  /* The key*/
+} HuntNode;
+
+/* Concurrent heap with a lock per node, after Hunt et al.: inserts move up and extracts move
+   down at the same time, holding at most a node and its children; a global lock only guards size*/
+typedef struct {
+    pthread_mutex_t sizeLock; /* Protects size*/
+    int size;                 /* Number of keys*/
+    int d;                    /* Degree of the heap*/
+    HuntNode *nodes;          /* HUNT_CAPACITY nodes*/
+} HuntHeap;
+
+/* Heap owned by one thread of a work-stealing queue, with what the owner did with it*/
+typedef struct {
+    _Alignas(CACHE_LINE) atomic_int locked; /* 1 while the owner or a thief works on the heap*/
+    atomic_int size;          /* Size of the heap, readable without the lock*/
+    Heap heap;                /* The heap*/
+    uint64_t seed;            /* Victim selection state of the owner*/
+    long inserts;             /* Keys the owner inserted*/
+    long extracts;            /* Keys the owner extracted, stolen ones included*/
+    long steals;              /* Successful steals by the owner*/
+    long stolen;              /* Keys the owner took from other heaps*/
+    long failedSteals;        /* Victims found empty or locked*/
+    int batch[STEAL_BATCH];   /* Keys being stolen*/
+} StealShard;
+
+/* Work-stealing queue: every thread inserts into and extracts from a heap of its own, and
+   only when that heap is empty takes a batch of the best keys from another thread's heap.
+   Extracts are only close to the global maximum, but threads seldom touch shared data*/
+typedef struct {
+    StealShard *shards;       /* One heap per thread*/
+    int numShards;            /* Number of heaps*/
+} StealQueue;
+
+/* Lock-free ring of keys from one producer to one consumer. Each index is written by one side
+   only and cached by the other, so the two rarely touch each other's cache lines*/
+typedef struct {
+    _Alignas(CACHE_LINE) atomic_size_t head; /* Next slot the producer writes*/
+    size_t cachedTail;        /* Producer's last view of tail*/
+    _Alignas(CACHE_LINE) atomic_size_t tail; /* Next slot the consumer reads*/
+    _Alignas(CACHE_LINE) int keys[RING_SIZE]; /* The slots*/
+} KeyRing;
+
+/* Heap fed through one ring per producer: an insert is a push onto the caller's ring, and
+   whoever holds the heap lock moves all queued keys in with insertMany() before extracting,
+   so producers stay off the lock and the sift-up work happens in batches*/
+typedef struct {
+    pthread_mutex_t lock;     /* Protects heap and the consumer side of the rings*/
+    Heap heap;                /* The heap*/
+    KeyRing *rings;           /* One ring per producer thread*/
+    int numRings;             /* Number of rings*/
+    int drained[RING_SIZE];   /* Keys taken off a ring, on their way into the heap*/
+    long drains;              /* Nonempty batches moved into the heap*/
+    long drainedKeys;         /* Keys moved into the heap*/
+    long fullRings;           /* Inserts that found their ring full and drained it themselves*/
+} RingQueue;
+
+/* A concurrent priority queue implementation, as seen by the concurrency benchmark*/
+typedef struct {
+    const char *name;                                   /* Name used on the command line and in reports*/
+    int strict;                                         /* 1 if extracts always return the maximum*/
+    void *(*create)(int d, int numThreads);             /* Creates an empty queue*/
+    void (*insert)(void *queue, int thread, int key);   /* Inserts a key from the given thread*/
+    int (*extract)(void *queue, int thread, int *key);  /* Extracts a key, returns 0 if none was found*/
+    void (*destroy)(void *queue);                       /* Releases the queue*/
+    void (*report)(void *queue, FILE *out);             /* Prints statistics of the queue, may be NULL*/
+} ConcurrentEngine;
+
+/* Work of one concurrency benchmark thread*/
+typedef struct {
+    const ConcurrentEngine *engine; /* Implementation under test*/
+    void *queue;              /* Queue under test*/
+    int thread;               /* Index of the thread*/
+    long operations;          /* Operations to run*/
+    int split;                /* 1 if even threads only insert and odd threads only extract*/
+    uint64_t seed;            /* Seed of the key and operation generator*/
+    pthread_barrier_t *start; /* Lets all threads start together*/
+} BenchThread;
+
+/* Heap that consumers can wait on: extracts block until a key arrives, the timeout expires
+   or the queue is closed, and producers only signal when someone is waiting*/
+typedef struct {
+    Heap heap;                /* The heap*/
+    pthread_mutex_t lock;     /* Protects everything below*/
+    pthread_cond_t notEmpty;  /* Signaled when keys arrive or the queue closes, on CLOCK_MONOTONIC*/
+    int waiters;              /* Consumers waiting on notEmpty*/
+    int pendingWakeups;       /* Signals sent to waiters that have not woken up yet*/
+    int closed;               /* 1 once no more keys will arrive*/
+    long signals;             /* Times a producer signaled notEmpty*/
+    long wakeups;             /* Times a consumer returned from waiting*/
+    long emptyWakeups;        /* Wakeups that found no key, the cost of a thundering herd*/
+} BlockingHeap;
+
+/* Header of a POSIX shared-memory heap segment. Every process maps the segment at its own
+ * address, so it holds no pointers: the keys are at keysOffset from the start of the segment*/
+typedef struct {
+    char magic[8];            /* SHARED_HEAP_MAGIC, written last when the segment is created*/
+    int32_t version;          /* SHARED_HEAP_VERSION*/
+    int32_t d;                /* Degree of the heap*/
+    int32_t capacity;         /* Keys the segment holds, fixed when it is created*/
+    int32_t reserved;         /* Reserved, 0*/
+    uint64_t keysOffset;      /* Offset of the keys from the start of the segment, a multiple of CACHE_LINE*/
+    pthread_mutex_t lock;     /* Process-shared robust mutex, protects the keys and everything below*/
+    pthread_cond_t notEmpty;  /* Process-shared, signaled when keys arrive or the heap closes, on CLOCK_MONOTONIC*/
+    int32_t size;             /* Keys in use*/
+    int32_t waiters;          /* Processes waiting on notEmpty*/
+    int32_t closed;           /* 1 once no more keys will arrive*/
+    int32_t recoveries;       /* Times a process died holding the lock and the heap was rebuilt*/
+    int64_t inserts;          /* Keys inserted by all processes*/
+    int64_t extracts;         /* Keys extracted by all processes*/
+} SharedHeapHeader;
+
+/* A shared-memory heap attached to this process*/
+typedef struct {
+    SharedHeapHeader *header; /* Start of the mapped segment*/
+    size_t length;            /* Length of the mapping in bytes*/
+    Heap heap;                /* The keys of the segment in place as a heap, whose size is valid while the lock is held*/
+} SharedHeap;
+
+/* Work of one blocking queue benchmark thread*/
+typedef struct {
+    BlockingHeap *queue;      /* Queue under test*/
+    long keys;                /* Keys a producer inserts*/
+    int batch;                /* Keys a producer inserts at once*/
+    long extracted;           /* Keys a consumer extracted*/
+    uint64_t seed;            /* Seed of the key generator*/
+} BlockingThread;
+
+/* Work of one stress test thread*/
+typedef struct {
+    const ConcurrentEngine *engine; /* Implementation under test*/
+    void *queue;              /* Queue under test*/
+    int thread;               /* Index of the thread*/
+    int numThreads;           /* Number of threads*/
+    long operations;          /* Operations to run in the mixed phase*/
+    uint64_t seed;            /* Seed of the operation generator*/
+    pthread_barrier_t *phase; /* Separates the mixed phase from the draining phase*/
+    int *inserted;            /* Keys inserted by this thread*/
+    long numInserted;         /* Number of keys inserted by this thread*/
+    int *extracted;           /* Keys extracted by all threads*/
+    atomic_long *numExtracted; /* Number of keys extracted by all threads*/
+    long orderErrors;         /* Extracts that returned a larger key than the previous one while draining*/
+} StressThread;
+
+/* One operation of a parsed script*/
+typedef struct {
+    char op;                  /* 'i', 'x', 'k' or 'd'*/
+    int index;                /* Index of 'k' and 'd'*/
+    int key;                  /* Key of 'i' and 'k'*/
+} ScriptOp;
+
+/* Hardware performance counters read around the timed code of the benchmark*/
+typedef struct {
+    int fds[PERF_EVENTS];     /* One perf event per counter, -1 if the machine does not count it*/
+    int slots[PERF_EVENTS];   /* Position of each counter in a group read, -1 if it is not open*/
+    int opened;               /* Counters open, 0 if none are available*/
+    uint64_t totals[PERF_EVENTS]; /* Counts since resetPerfCounters()*/
+} PerfCounters;
+
+/* Work of one heap benchmark measurement*/
+typedef struct {
+    const char *distribution; /* Name of the key distribution*/
+    int d;                    /* Degree of the heap*/
+    int size;                 /* Number of keys in the heap*/
+    const int *keys;          /* size keys in the order of the distribution*/
+    int json;                 /* 1 for JSON lines, 0 for CSV*/
+    uint64_t seed;            /* Seed of the index and increment generator*/
+    PerfCounters *perf;       /* Hardware counters to read, NULL not to*/
+} BenchCase;
+
 /* Function prototypes*/
+void initHeap(Heap *heap, int capacity, int d);
+void reserveHeap(Heap *heap, int capacity);
+void freeHeap(Heap *heap);
+void resetChanges(Heap *heap);
+void markChanged(Heap *heap, int from, int to);
+void markHeapFileDirty(Heap *heap);
+void resetHeapStats(Heap *heap);
+void printHeapStats(const Heap *heap, FILE *out);
 void swap(int *x, int *y);
 int child(int i, int k, int d);
 int parent(int i, int d);
 void dmaxHeapify(Heap *heap, int i);
+void siftUp(Heap *heap, int i);
+int removeMax(Heap *heap);
 int heapExtractMax(Heap *heap);
 void insert(Heap *heap, int key);
 void increaseKey(Heap *heap, int i, int key);
 void buildMaxHeap(Heap *heap);
 void delete(Heap *heap, int index);
+void insertMany(Heap *heap, const int *keys, int count);
+int extractTop(Heap *heap, int *keys, int count);
 int isNumber(const char *str);
-void readHeapsFromFile(Heap heaps[], int *numHeaps, const char *fileName);
+void mapInputFile(InputFile *input, const char *fileName);
+void unmapInputFile(InputFile *input);
+uint64_t parseEightDigits(uint64_t chunk);
+const char *parseInt(const char *p, const char *end, int *value);
+const char *parseHeapLine(const char *p, const char *end, Heap *heap);
+int getThreadCount(void);
+void *ingestWorker(void *arg);
+Heap *readHeapsFromFile(int *numHeaps, const char *fileName, int d);
+int loadIndexFile(HeapIndex *index, const char *indexName, const struct stat *info);
+void saveIndexFile(const HeapIndex *index, const char *indexName, const struct stat *info);
+void openHeapIndex(HeapIndex *index, const char *fileName);
+Heap *getIndexedHeap(HeapIndex *index, int i, int d);
+void printIndexedLine(const HeapIndex *index, int i);
+void closeHeapIndex(HeapIndex *index);
+void writeAll(int fd, const void *data, size_t length);
+void flushOutput(OutputBuffer *out);
+void writeOutput(OutputBuffer *out, const void *data, size_t length);
+void writeIntOutput(OutputBuffer *out, int value);
 void printHeap(Heap *heap);
+void printHeapRange(Heap *heap, int from, int to);
+void dumpHeapKeys(const Heap *heap, const char *fileName);
+int isMaxHeap(const Heap *heap);
+int isHeapFile(const char *fileName);
+void openHeapFile(Heap *heap, const char *fileName, int isPrivate);
+void syncHeapFile(Heap *heap);
+int writeHeapFile(const Heap *heap, FILE *file, SnapshotProgress *progress);
+void saveHeapFile(const Heap *heap, const char *fileName);
+void openRawKeyFile(Heap *heap, const char *fileName, int d);
+void startTrace(Heap *heap, const char *fileName);
+void traceOperation(Heap *heap, char op, int index, int key);
+void traceKeys(Heap *heap, char op, const int *keys, int count);
+void stopTrace(Heap *heap);
+int isTrace(const char *data, size_t length);
+long readTrace(const char *data, size_t length, ScriptOp **ops, int **pool, int *numInitial, int *d);
+int syncParentDirectory(const char *fileName);
+void startHeapLog(Heap *heap, const char *fileName, long syncMs);
+void checkpointHeapLog(Heap *heap);
+void trimHeapLog(Heap *heap);
+void commitHeapLog(Heap *heap, int force);
+void stopHeapLog(Heap *heap);
+int recoverHeapLog(Heap *heap, const char *fileName);
+int findLaterLog(const char *prefix, int id);
 int getIntInput(const char *prompt, int min, int max);
+uint64_t nowNanoseconds(void);
+int latencyBucket(uint64_t nanoseconds);
+uint64_t latencyBucketLimit(int bucket);
+void recordLatency(LatencyHistogram *histogram, uint64_t nanoseconds);
+uint64_t latencyPercentile(const LatencyHistogram *histogram, double fraction);
+void initLatencyRecorder(LatencyRecorder *recorder, int sampleEvery);
+int sampleLatency(LatencyRecorder *recorder, char op);
+void mergeLatencies(const LatencyRecorder *recorder, LatencyHistogram *all);
+void printLatencies(const LatencyRecorder *recorder, FILE *out);
+void loadHeap(Heap *heap, const char *fileName, int heapNumber, int d, int isRaw);
+const char *skipBlanks(const char *p, const char *end);
+void executeScriptLine(Heap *heap, const char *p, const char *end, long lineNumber, BatchStats *stats,
+                       LatencyRecorder *latency);
+int runBatch(int argc, const char *argv[]);
+int createTableHeap(HeapTable *table, int d);
+void executeRequest(HeapTable *table, const ProtocolRequest *request, ProtocolResponse *response);
+size_t processRequests(HeapTable *table, const char *data, size_t length, OutputBuffer *out);
+void loadHeapTable(HeapTable *table, const char *fileName, int d);
+void startTableTrace(HeapTable *table, int id);
+void traceHeapTable(HeapTable *table, const char *prefix);
+void logHeapTable(HeapTable *table, const char *prefix, long syncMs);
+void commitHeapTable(HeapTable *table);
+void writeSnapshot(const Heap *heap, const char *fileName, int keep, SnapshotProgress *progress);
+ProtocolStatus startSnapshot(HeapTable *table, int id);
+SnapshotState pollSnapshot(HeapTable *table, int wait);
+void freeHeapTable(HeapTable *table);
+int runPipe(int argc, const char *argv[]);
+uint64_t nextRandom(uint64_t *state);
+int serveConnection(HeapTable *table, Connection *connection);
+void stopServer(int signalNumber);
+int runServer(int argc, const char *argv[]);
+void readFully(int fd, void *data, size_t length);
+void *loadClientThread(void *arg);
+int compareUint64(const void *a, const void *b);
+int runLoadGenerator(int argc, const char *argv[]);
+void *createLockedHeap(int d, int numThreads);
+void lockedInsert(void *queue, int thread, int key);
+int lockedExtract(void *queue, int thread, int *key);
+void destroyLockedHeap(void *queue);
+void *createCombiningHeap(int d, int numThreads);
+void combine(CombiningHeap *queue);
+int combiningRequest(CombiningHeap *queue, int thread, CombiningState op, int *key);
+void combiningInsert(void *queue, int thread, int key);
+int combiningExtract(void *queue, int thread, int *key);
+void destroyCombiningHeap(void *queue);
+void *createMultiQueue(int d, int numThreads);
+int tryLockShard(MultiQueueShard *shard);
+void unlockShard(MultiQueueShard *shard);
+void multiQueueInsert(void *queue, int thread, int key);
+int multiQueueExtract(void *queue, int thread, int *key);
+void destroyMultiQueue(void *queue);
+void *createHuntHeap(int d, int numThreads);
+void backOff(int *spins);
+void lockNode(HuntNode *node);
+void unlockNode(HuntNode *node);
+void swapNodes(HuntNode *a, HuntNode *b);
+void huntInsert(void *queue, int thread, int key);
+int huntExtract(void *queue, int thread, int *key);
+void destroyHuntHeap(void *queue);
+void *createStealQueue(int d, int numThreads);
+int tryLockStealShard(StealShard *shard);
+void lockStealShard(StealShard *shard);
+void unlockStealShard(StealShard *shard);
+void stealInsert(void *queue, int thread, int key);
+int stealFrom(StealShard *own, StealShard *victim, int *key);
+int stealExtract(void *queue, int thread, int *key);
+void reportStealQueue(void *queue, FILE *out);
+void destroyStealQueue(void *queue);
+int pushRing(KeyRing *ring, int key);
+int popRing(KeyRing *ring, int *keys, int max);
+void *createRingQueue(int d, int numThreads);
+void drainRings(RingQueue *queue);
+void ringInsert(void *queue, int thread, int key);
+int ringExtract(void *queue, int thread, int *key);
+void reportRingQueue(void *queue, FILE *out);
+void destroyRingQueue(void *queue);
+const ConcurrentEngine *findEngine(const char *name);
+void addRank(int *tree, int key, int delta);
+long countAbove(const int *tree, int key);
+void measureRankError(const ConcurrentEngine *engine, int d, int numThreads, long operations, int prefill);
+void *benchThread(void *arg);
+double runConcurrentTrial(const ConcurrentEngine *engine, int d, int numThreads, long operations, int prefill, int split, int verbose);
+int runConcurrentBenchmark(int argc, const char *argv[]);
+void *stressThread(void *arg);
+int compareInt(const void *a, const void *b);
+int runStressTrial(const ConcurrentEngine *engine, int d, int numThreads, long operations);
+int runStressTest(int argc, const char *argv[]);
+void initBlockingHeap(BlockingHeap *queue, int d);
+void wakeConsumers(BlockingHeap *queue, int count);
+void blockingInsert(BlockingHeap *queue, int key);
+void blockingInsertMany(BlockingHeap *queue, const int *keys, int count);
+int blockingExtract(BlockingHeap *queue, int *key, long timeoutMs);
+int tryBlockingExtract(BlockingHeap *queue, int *key);
+void closeBlockingHeap(BlockingHeap *queue);
+void freeBlockingHeap(BlockingHeap *queue);
+void *blockingProducer(void *arg);
+void *blockingConsumer(void *arg);
+int runBlockingBenchmark(int argc, const char *argv[]);
+void createSharedHeap(const char *name, int capacity, int d);
+void attachSharedHeap(SharedHeap *shared, const char *name);
+void detachSharedHeap(SharedHeap *shared);
+void repairSharedHeap(SharedHeap *shared);
+void lockSharedHeap(SharedHeap *shared);
+void unlockSharedHeap(SharedHeap *shared);
+int sharedInsert(SharedHeap *shared, const int *keys, int count);
+int sharedExtract(SharedHeap *shared, int *key, long timeoutMs);
+void closeSharedHeap(SharedHeap *shared);
+double runSharedBenchmark(SharedHeap *shared, const char *name, int producers, int consumers, long keys, int batch);
+int runSharedHeap(int argc, const char *argv[]);
+void fillBenchKeys(int *keys, int size, const char *distribution, const int *pool, int poolSize, uint64_t *seed);
+int *loadKeyPool(const char *fileName, int *poolSize);
+int openPerfCounters(PerfCounters *perf);
+void resetPerfCounters(PerfCounters *perf);
+void startPerfCounters(PerfCounters *perf);
+void stopPerfCounters(PerfCounters *perf);
+void closePerfCounters(PerfCounters *perf);
+void printBenchResult(const BenchCase *bench, const char *operation, long operations, uint64_t nanoseconds,
+                      long long comparisons, long long swaps);
+void runBenchCase(const BenchCase *bench);
+int runHeapBenchmark(int argc, const char *argv[]);
+void rebuildHeap(Heap *heap, int d);
+int heapLevels(long size, int d);
+int chooseDegree(long up, long down, long size, int current);
+long parseScript(const char *data, size_t length, ScriptOp **ops);
+long replayScript(Heap *heap, const ScriptOp *ops, long count, const int *pool, LatencyRecorder *latency);
+long replayOnEngine(const ConcurrentEngine *engine, void *queue, const ScriptOp *ops, long count, const int *pool,
+                    LatencyRecorder *latency);
+int runTuner(int argc, const char *argv[]);
+int runReplay(int argc, const char *argv[]);
+int skewedIndex(uint64_t *seed, int size, int skew);
+int generateKey(uint64_t *seed, const char *model, int last, int increment);
+int runGenerator(int argc, const char *argv[]);
+
+/**
+ * Initializes an empty heap whose array is allocated on the heap.
+ * @param heap Pointer to the heap to initialize.
+ * @param capacity Number of elements to allocate room for.
+ * @param d The degree of the heap.
+ */
+void initHeap(Heap *heap, int capacity, int d)
+{
+    if (capacity < 1)
+        capacity = 1;
+
+    heap->array = malloc((size_t)capacity * sizeof(int));
+    if (!heap->array)
+    {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    heap->size = 0;
+    heap->capacity = capacity;
+    heap->d = d;
+    heap->storage = HEAP_STORAGE_MALLOC;
+    heap->header = NULL;
+    heap->mappedLength = 0;
+    heap->fd = -1;
+    heap->trace = NULL;
+    heap->log = NULL;
+    resetChanges(heap);
+    resetHeapStats(heap);
+}
+
+/**
+ * Makes sure the heap can hold at least capacity elements.
+ * A mapped heap file is extended on disk and mapped again, so the keys stay in place in the file.
+ * @param heap Pointer to the heap.
+ * @param capacity The minimal number of elements the array must be able to hold.
+ */
+void reserveHeap(Heap *heap, int capacity)
+{
+    int newCapacity = heap->capacity;
+    size_t length;
+    void *mapping;
+
+    if (capacity <= heap->capacity)
+        return;
+
+    while (newCapacity < capacity)
+        newCapacity = newCapacity > INT_MAX / 2 ? INT_MAX : newCapacity * 2;
+
+    if (heap->storage == HEAP_STORAGE_PRIVATE_MAP)
+    {
+        /*a private mapping cannot grow, move the keys to malloc storage*/
+        int *array = malloc((size_t)newCapacity * sizeof(int));
+        if (!array)
+        {
+            fprintf(stderr, "Error: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(array, heap->array, (size_t)heap->size * sizeof(int));
+        munmap(heap->header ? (void *)heap->header : heap->array, heap->mappedLength);
+        heap->array = array;
+        heap->header = NULL;
+        heap->capacity = newCapacity;
+        heap->storage = HEAP_STORAGE_MALLOC;
+        heap->mappedLength = 0;
+        return;
+    }
+
+    if (heap->storage == HEAP_STORAGE_SHARED)
+    {
+        fprintf(stderr, "Error: shared heap is full\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (heap->storage == HEAP_STORAGE_MALLOC)
+    {
+        int *array = realloc(heap->array, (size_t)newCapacity * sizeof(int));
+        if (!array)
+        {
+            fprintf(stderr, "Error: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        heap->array = array;
+        heap->capacity = newCapacity;
+        return;
+    }
+
+    /*grow the file and map it again*/
+    length = sizeof(HeapFileHeader) + (size_t)newCapacity * sizeof(int);
+    if (ftruncate(heap->fd, (off_t)length) != 0)
+    {
+        perror("Error growing heap file");
+        exit(EXIT_FAILURE);
+    }
+    munmap(heap->header, heap->mappedLength);
+    mapping = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, heap->fd, 0);
+    if (mapping == MAP_FAILED)
+    {
+        perror("Error mapping heap file");
+        exit(EXIT_FAILURE);
+    }
+    heap->header = mapping;
+    heap->header->capacity = newCapacity;
+    heap->array = (int *)(heap->header + 1);
+    heap->capacity = newCapacity;
+    heap->mappedLength = length;
+}
+
+/**
+ * Releases the array of a heap.
+ * A mapped heap file is synced first so that its header matches the keys, and a trace or log is closed.
+ * @param heap Pointer to the heap.
+ */
+void freeHeap(Heap *heap)
+{
+    if (heap->log)
+        stopHeapLog(heap);
+    if (heap->trace)
+        stopTrace(heap);
+    if (heap->storage == HEAP_STORAGE_FILE)
+    {
+        syncHeapFile(heap);
+        munmap(heap->header, heap->mappedLength);
+        close(heap->fd);
+    }
+    else if (heap->storage == HEAP_STORAGE_PRIVATE_MAP)
+        munmap(heap->header ? (void *)heap->header : heap->array, heap->mappedLength);
+    else if (heap->storage == HEAP_STORAGE_MALLOC)
+        free(heap->array); /*shared keys belong to their segment, see detachSharedHeap()*/
+
+    heap->array = NULL;
+    heap->header = NULL;
+    heap->size = 0;
+    heap->capacity = 0;
+    heap->fd = -1;
+}
+
+/**
+ * Forgets which indexes of the heap were changed, so the next operation can be tracked on its own.
+ * @param heap Pointer to the heap.
+ */
+void resetChanges(Heap *heap)
+{
+    heap->changedFrom = INT_MAX;
+    heap->changedTo = -1;
+}
+
+/**
+ * Records that the keys between two indexes may have changed.
+ * @param heap Pointer to the heap.
+ * @param from Lowest changed index.
+ * @param to Highest changed index.
+ */
+void markChanged(Heap *heap, int from, int to)
+{
+    if (from < heap->changedFrom)
+        heap->changedFrom = from;
+    if (to > heap->changedTo)
+        heap->changedTo = to;
+}
+
+/**
+ * Marks the file of a mapped heap as unordered before its keys change, so that a file left
+ * behind by a crash or an error exit is heapified again when it is reopened. syncHeapFile()
+ * marks it ordered again once the operation is complete.
+ * @param heap Pointer to the heap, nothing is done unless it is mapped from a file.
+ */
+void markHeapFileDirty(Heap *heap)
+{
+    if (heap->storage == HEAP_STORAGE_FILE && heap->header->ordering != HEAP_UNORDERED)
+        heap->header->ordering = HEAP_UNORDERED;
+}
+
+/**
+ * Sets the operation counters of a heap back to zero. Does nothing unless the program is
+ * compiled with -DHEAP_STATS.
+ * @param heap Pointer to the heap.
+ */
+void resetHeapStats(Heap *heap)
+{
+#ifdef HEAP_STATS
+    memset(&heap->stats, 0, sizeof(heap->stats));
+#else
+    (void)heap;
+#endif
+}
+
+/**
+ * Prints the operation counters of a heap, with averages per operation. Without
+ * -DHEAP_STATS only a note that the counters are not compiled in is printed.
+ * @param heap Pointer to the heap.
+ * @param out Where to print.
+ */
+void printHeapStats(const Heap *heap, FILE *out)
+{
+#ifdef HEAP_STATS
+    const HeapStats *stats = &heap->stats;
+    long long operations = stats->inserts + stats->extracts + stats->increases + stats->deletes;
+
+    fprintf(out, "Heap statistics (d=%d, size=%d):\n", heap->d, heap->size);
+    fprintf(out, "  operations: %lld inserts, %lld extracts, %lld increases, %lld deletes, %lld builds\n",
+            stats->inserts, stats->extracts, stats->increases, stats->deletes, stats->builds);
+    fprintf(out, "  comparisons: %lld (%.2f per operation)\n", stats->comparisons,
+            operations ? (double)stats->comparisons / operations : 0.0);
+    fprintf(out, "  moves: %lld (%.2f per operation)\n", stats->moves,
+            operations ? (double)stats->moves / operations : 0.0);
+    fprintf(out, "  levels sifted: %lld up, %lld down\n", stats->siftUpLevels, stats->siftDownLevels);
+#else
+    (void)heap;
+    fprintf(out, "Heap statistics are not compiled in, build with -DHEAP_STATS\n");
+#endif
+}
 
 /**
  * Swaps two integers.
@@ -86,6 +1026,7 @@ void dmaxHeapify(Heap *heap, int i)
     int childrens;
     int largest;
     int j;
+    int start = i;
     while (1)
     {
         largest = i;
@@ -93,7 +1034,7 @@ void dmaxHeapify(Heap *heap, int i)
         for (j = 1; j <= heap->d; ++j)
         {
             childrens = child(i, j, heap->d);
-            if (childrens < heap->size && heap->array[childrens] > heap->array[largest])
+            if (childrens < heap->size && (HEAP_COUNT(heap, comparisons, 1), heap->array[childrens] > heap->array[largest]))
                 largest = childrens;
             
         }
@@ -101,12 +1042,52 @@ void dmaxHeapify(Heap *heap, int i)
         if (largest != i) 
         {
             swap(&heap->array[i], &heap->array[largest]);
+            HEAP_COUNT(heap, moves, 2);
+            HEAP_COUNT(heap, siftDownLevels, 1);
             i = largest;
         }
         else
             break;
         
     }
+    if (i != start)
+        markChanged(heap, start, i);
+}
+
+/**
+ * Moves the key at a given index up until its parent is not smaller.
+ * Shared by insert, increase-key and delete.
+ * @param heap Pointer to the heap.
+ * @param i Index of the key.
+ */
+void siftUp(Heap *heap, int i)
+{
+    int start = i;
+    while (i > ROOT && (HEAP_COUNT(heap, comparisons, 1), heap->array[parent(i, heap->d)] < heap->array[i]))
+    {
+        swap(&heap->array[i], &heap->array[parent(i, heap->d)]);
+        HEAP_COUNT(heap, moves, 2);
+        HEAP_COUNT(heap, siftUpLevels, 1);
+        i = parent(i, heap->d);
+    }
+    markChanged(heap, i, start);
+}
+
+/**
+ * Removes the root of a non-empty heap: the last key takes its place and is heapified down.
+ * Shared by extract and delete.
+ * @param heap Pointer to the heap.
+ * @return The removed root.
+ */
+int removeMax(Heap *heap)
+{
+    int max = heap->array[ROOT];
+    heap->array[ROOT] = heap->array[heap->size - 1];
+    heap->size -= 1;
+    HEAP_COUNT(heap, moves, 1);
+    markChanged(heap, ROOT, ROOT);
+    dmaxHeapify(heap, ROOT);
+    return max;
 }
 
 /**
@@ -117,19 +1098,17 @@ void dmaxHeapify(Heap *heap, int i)
  */
 int heapExtractMax(Heap *heap)
 {
-    int max;
     if (heap->size < 1)
     {
         fprintf(stderr, "Error: heap underflow\n");
         exit(EXIT_FAILURE);
     }
 
-    max = heap->array[ROOT];
-    heap->array[ROOT] = heap->array[heap->size - 1];
-    heap->size -= 1;
-    dmaxHeapify(heap, ROOT);
-
-    return max;
+    HEAP_COUNT(heap, extracts, 1);
+    if (heap->trace)
+        traceOperation(heap, 'x', 0, 0);
+    markHeapFileDirty(heap);
+    return removeMax(heap);
 }
 
 /**
@@ -140,22 +1119,21 @@ int heapExtractMax(Heap *heap)
  */
 void insert(Heap *heap, int key)
 {
-    int i;
-    if (heap->size == MAX_CAPACITY)
+    if (heap->size == INT_MAX)
     {
         fprintf(stderr, "Error: heap overflow\n");
         exit(EXIT_FAILURE);
     }
 
+    markHeapFileDirty(heap);
+    reserveHeap(heap, heap->size + 1);
     heap->array[heap->size] = key;
-    i = heap->size;
     heap->size++;
-
-    while (i > ROOT && heap->array[parent(i, heap->d)] < heap->array[i])
-    {
-        swap(&heap->array[i], &heap->array[parent(i, heap->d)]);
-        i = parent(i, heap->d);
-    }
+    HEAP_COUNT(heap, inserts, 1);
+    HEAP_COUNT(heap, moves, 1);
+    if (heap->trace)
+        traceOperation(heap, 'i', 0, key);
+    siftUp(heap, heap->size - 1);
 }
 
 /**
@@ -167,19 +1145,19 @@ void insert(Heap *heap, int key)
  */
 void increaseKey(Heap *heap, int i, int key)
 {
-    
     if (key < heap->array[i])
     {
         fprintf(stderr, "Error: new key is smaller than current key\n");
         exit(EXIT_FAILURE);
     }
 
+    markHeapFileDirty(heap);
     heap->array[i] = key;
-    while (i > 0 && heap->array[parent(i, heap->d)] < heap->array[i])
-    {
-        swap(&heap->array[i], &heap->array[parent(i, heap->d)]);
-        i = parent(i, heap->d);
-    }
+    HEAP_COUNT(heap, increases, 1);
+    HEAP_COUNT(heap, moves, 1);
+    if (heap->trace)
+        traceOperation(heap, 'k', i, key);
+    siftUp(heap, i);
 }
 
 /**
@@ -190,7 +1168,9 @@ void increaseKey(Heap *heap, int i, int key)
 void buildMaxHeap(Heap *heap)
 {
     int i;
-    for (i = (heap->size / heap->d)-1 ; i >= 0; i--)/*minus 1 because we start at index 0*/
+    markHeapFileDirty(heap);
+    HEAP_COUNT(heap, builds, 1);
+    for (i = parent(heap->size - 1, heap->d); i >= 0; i--)/*start at the parent of the last element*/
         dmaxHeapify(heap, i);
 }
 
@@ -209,8 +1189,80 @@ void delete(Heap *heap, int index)
         exit(EXIT_FAILURE);
     }
 
-    increaseKey(heap, index, INT_MAX); /* Increase key to maximum*/
-    heapExtractMax(heap); /* Extract the new maximum, effectively deleting the original element*/
+    HEAP_COUNT(heap, deletes, 1);
+    if (heap->trace)
+        traceOperation(heap, 'd', index, 0);
+    markHeapFileDirty(heap);
+    heap->array[index] = INT_MAX; /* Increase key to maximum*/
+    HEAP_COUNT(heap, moves, 1);
+    siftUp(heap, index);
+    removeMax(heap); /* Extract the new maximum, effectively deleting the original element*/
+}
+
+/**
+ * Inserts a batch of keys into the heap.
+ * The keys are appended and only the ancestors of the new leaves are heapified, level by level
+ * from the bottom like buildMaxHeap(), which costs O(count + d log n) instead of a sift-up per key.
+ * Batches smaller than d are inserted one by one, since sift-up is cheaper for them.
+ * @param heap Pointer to the heap.
+ * @param keys The keys to insert.
+ * @param count Number of keys.
+ */
+void insertMany(Heap *heap, const int *keys, int count)
+{
+    int from, to, i;
+
+    if (count < heap->d)
+    {
+        for (i = 0; i < count; i++)
+            insert(heap, keys[i]);
+        return;
+    }
+    if (count > INT_MAX - heap->size)
+    {
+        fprintf(stderr, "Error: heap overflow\n");
+        exit(EXIT_FAILURE);
+    }
+
+    markHeapFileDirty(heap);
+    reserveHeap(heap, heap->size + count);
+    memcpy(heap->array + heap->size, keys, (size_t)count * sizeof(int));
+    HEAP_COUNT(heap, inserts, count);
+    HEAP_COUNT(heap, moves, count);
+    if (heap->trace)
+        traceKeys(heap, 'm', keys, count);
+    from = parent(heap->size, heap->d);
+    if (from < ROOT)
+        from = ROOT;
+    heap->size += count;
+    to = parent(heap->size - 1, heap->d);
+    markChanged(heap, heap->size - count, heap->size - 1);
+
+    /*the parents of a run of nodes are again a run, one level up*/
+    while (1)
+    {
+        for (i = to; i >= from; i--)
+            dmaxHeapify(heap, i);
+        if (from <= ROOT)
+            break;
+        from = parent(from, heap->d);
+        to = parent(to, heap->d);
+    }
+}
+
+/**
+ * Extracts up to count of the largest keys from the heap, largest first.
+ * @param heap Pointer to the heap.
+ * @param keys Where to store the extracted keys.
+ * @param count Number of keys wanted.
+ * @return Number of keys extracted, less than count if the heap ran empty.
+ */
+int extractTop(Heap *heap, int *keys, int count)
+{
+    int i;
+    for (i = 0; i < count && heap->size > 0; i++)
+        keys[i] = heapExtractMax(heap);
+    return i;
 }
 
 /**
@@ -232,81 +1284,6120 @@ int isNumber(const char *str) {
 
 
 /**
- * Reads heap data from a file and populates an array of Heaps.
- * This function is crucial for initializing heaps with data from an external source.
- * @param heaps Array of Heap structures to be populated.
- * @param numHeaps Pointer to store the number of heaps read.
- * @param fileName Name of the file containing heap data.
+ * Loads a whole input file into memory.
+ * Regular files are mapped read-only, anything else (a pipe for example) is read into one buffer.
+ * @param input The input file to fill in.
+ * @param fileName Name of the file to load.
  */
-void readHeapsFromFile(Heap heaps[], int *numHeaps,const char *fileName)
+void mapInputFile(InputFile *input, const char *fileName)
 {
-    FILE *file =  fopen(fileName, "r");
+    struct stat info;
+    char *buffer = NULL;
+    size_t capacity = 0, length = 0;
+    ssize_t count;
+    int fd = open(fileName, O_RDONLY);
 
-    if (!file)
+    if (fd < 0 || fstat(fd, &info) != 0)
     {
         fprintf(stderr, "Error opening file.\n");
         exit(EXIT_FAILURE);
     }
-    
-    char line[MAX_LINE_LENGTH];
-    int heapIndex = 0;
-    while (fgets(line, MAX_LINE_LENGTH, file) && heapIndex < MAX_HEAPS)
+
+    if (S_ISREG(info.st_mode) && info.st_size > 0)
     {
-        char *token = strtok(line, " ");
-        heaps[heapIndex].size = 0;
+        void *mapping = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED)
+        {
+            madvise(mapping, (size_t)info.st_size, MADV_SEQUENTIAL);
+            input->data = mapping;
+            input->length = (size_t)info.st_size;
+            input->mapped = 1;
+            close(fd);
+            return;
+        }
+    }
 
-        while (token != NULL)
+    do
+    {
+        if (length == capacity)
         {
-            heaps[heapIndex].array[heaps[heapIndex].size] = atoi(token);
-            heaps[heapIndex].size++;
-            token = strtok(NULL, " ");
+            capacity = capacity ? capacity * 2 : 1 << 20;
+            buffer = realloc(buffer, capacity);
+            if (!buffer)
+            {
+                fprintf(stderr, "Error: out of memory\n");
+                exit(EXIT_FAILURE);
+            }
         }
+        count = read(fd, buffer + length, capacity - length);
+        if (count < 0)
+        {
+            perror("Error reading file");
+            exit(EXIT_FAILURE);
+        }
+        length += (size_t)count;
+    } while (count > 0);
 
-        heapIndex++;
-    }
+    input->data = buffer;
+    input->length = length;
+    input->mapped = 0;
+    close(fd);
+}
 
-    *numHeaps = heapIndex;
-    fclose(file);
+/**
+ * Releases an input file loaded with mapInputFile().
+ * @param input The input file to release.
+ */
+void unmapInputFile(InputFile *input)
+{
+    if (input->mapped)
+        munmap((void *)input->data, input->length);
+    else
+        free((void *)input->data);
+    input->data = NULL;
+    input->length = 0;
 }
 
 /**
- * Prints all elements of a heap.
- * This is used for displaying the current state of a heap.
- * @param heap Pointer to the heap to be printed.
+ * Converts the eight digit characters packed in a word to their value.
+ * The first character must be in the lowest byte, as on a little-endian load.
+ * @param chunk Eight digit characters, or leading zero bytes followed by digit characters.
+ * @return The value of the eight digits.
  */
-void printHeap(Heap *heap)
+uint64_t parseEightDigits(uint64_t chunk)
 {
-    int i;
-    for (i = 0; i < heap->size; i++)
-        printf("%d ", heap->array[i]);
-    printf("\n");
+    chunk = ((chunk & 0x0F0F0F0F0F0F0F0FULL) * 2561) >> 8;
+    chunk = ((chunk & 0x00FF00FF00FF00FFULL) * 6553601) >> 16;
+    return ((chunk & 0x0000FFFF0000FFFFULL) * 42949672960001ULL) >> 32;
 }
 
 /**
- * Prompts the user for integer input within a specified range.
- * This function ensures that user input is valid and within the required bounds.
+ * Parses one decimal integer with an optional sign.
+ * Where at least eight bytes are left the leading digits are located and converted a word at a time.
+ * @param p First character of the number.
+ * @param end End of the buffer.
+ * @param value Where to store the parsed number.
+ * @return Pointer just past the number, or NULL if there is no number at p or it does not fit in an int.
+ */
+const char *parseInt(const char *p, const char *end, int *value)
+{
+    uint64_t result = 0;
+    uint64_t limit = INT_MAX;
+    unsigned int digit;
+    int negative = 0;
+
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        negative = *p == '-';
+        limit += negative;
+        p++;
+    }
+    if (p == end || (unsigned int)(*p - '0') > 9)
+        return NULL;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if (end - p >= 8)
+    {
+        uint64_t chunk, nonDigits;
+        int digits;
+
+        memcpy(&chunk, p, sizeof(chunk));
+        chunk ^= 0x3030303030303030ULL;
+        /*a byte is a digit iff both it and it plus 6 stay below 16*/
+        nonDigits = (chunk | (chunk + 0x0606060606060606ULL)) & 0xF0F0F0F0F0F0F0F0ULL;
+        digits = nonDigits ? __builtin_ctzll(nonDigits) / 8 : 8;
+        if (digits < 8)
+            chunk <<= 8 * (8 - digits);
+        result = parseEightDigits(chunk);
+        p += digits;
+    }
+#endif
+
+    /*the limit check after every digit also stops runaway digit strings early*/
+    while (p < end && (digit = (unsigned int)(*p - '0')) <= 9)
+    {
+        result = result * 10 + digit;
+        if (result > limit)
+            return NULL;
+        p++;
+    }
+
+    *value = negative ? (int)(-(int64_t)result) : (int)result;
+    return p;
+}
+
+/**
+ * Parses all the keys on one line and appends them to a heap.
+ * Keys may be separated by any amount of spaces, tabs or carriage returns.
+ * @param p First character of the line.
+ * @param end End of the buffer.
+ * @param heap The heap to append the keys to.
+ * @return Pointer to the first character of the next line, or NULL on an invalid or out of range number.
+ */
+const char *parseHeapLine(const char *p, const char *end, Heap *heap)
+{
+    const char *next;
+
+    while (p < end)
+    {
+        switch (*p)
+        {
+            case '\n':
+                return p + 1;
+            case ' ': case '\t': case '\r': case '\v': case '\f':
+                p++;
+                break;
+            default:
+                if (heap->size == heap->capacity)
+                    reserveHeap(heap, heap->size + 1);
+                next = parseInt(p, end, &heap->array[heap->size]);
+                if (!next || (next < end && !isspace((unsigned char)*next)))
+                    return NULL;
+                heap->size++;
+                p = next;
+        }
+    }
+    return p;
+}
+
+/**
+ * Finds how many threads to use for parallel work.
+ * @return The number of online processors, at least 1.
+ */
+int getThreadCount(void)
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count < 1 ? 1 : (int)count;
+}
+
+/**
+ * Thread body for readHeapsFromFile(): takes chunks until none are left and parses
+ * (and, if a degree was given, builds) every heap in them.
+ * @param arg Pointer to the shared IngestJob.
+ * @return Always NULL.
+ */
+void *ingestWorker(void *arg)
+{
+    IngestJob *job = arg;
+    IngestChunk *chunk;
+    const char *p;
+    Heap heap;
+    int index;
+
+    while ((index = atomic_fetch_add(&job->nextChunk, 1)) < job->numChunks)
+    {
+        chunk = &job->chunks[index];
+        p = chunk->begin;
+        while (p && p < chunk->end)
+        {
+            initHeap(&heap, INITIAL_CAPACITY, job->d);
+            p = parseHeapLine(p, chunk->end, &heap);
+            chunk->lines++;
+
+            /*blank lines are skipped*/
+            if (heap.size == 0)
+            {
+                freeHeap(&heap);
+                continue;
+            }
+
+            if (job->d > 0)
+                buildMaxHeap(&heap);
+            if (chunk->numHeaps == chunk->capacity)
+            {
+                chunk->capacity = chunk->capacity ? chunk->capacity * 2 : 16;
+                chunk->heaps = realloc(chunk->heaps, (size_t)chunk->capacity * sizeof(Heap));
+                if (!chunk->heaps)
+                {
+                    fprintf(stderr, "Error: out of memory\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            chunk->heaps[chunk->numHeaps++] = heap;
+        }
+        chunk->error = p == NULL;
+    }
+    return NULL;
+}
+
+/**
+ * Reads heap data from a file and returns an array of Heaps.
+ * Every non-empty line of the file is one heap. The file is split at newlines into chunks
+ * that are parsed, and built if d is given, concurrently by one thread per processor.
+ * @param numHeaps Pointer to store the number of heaps read.
+ * @param fileName Name of the file containing heap data.
+ * @param d The degree to build every heap with, or 0 to keep the keys in file order.
+ * @return Array of numHeaps heaps in file order, to be released with freeHeap() and free().
+ */
+Heap *readHeapsFromFile(int *numHeaps, const char *fileName, int d)
+{
+    InputFile input;
+    IngestJob job;
+    Heap *heaps;
+    pthread_t *threads;
+    const char *p, *end, *split;
+    int numThreads = getThreadCount();
+    int total = 0;
+    long lineNumber = 0;
+    int i;
+
+    mapInputFile(&input, fileName);
+    end = input.data + input.length;
+
+    /*split the file into newline-aligned chunks*/
+    job.numChunks = numThreads * CHUNKS_PER_THREAD;
+    if ((size_t)job.numChunks > input.length / MIN_CHUNK_SIZE)
+        job.numChunks = (int)(input.length / MIN_CHUNK_SIZE) + 1;
+    job.chunks = calloc((size_t)job.numChunks, sizeof(IngestChunk));
+    if (!job.chunks)
+    {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    p = input.data;
+    for (i = 0; i < job.numChunks; i++)
+    {
+        job.chunks[i].begin = p;
+        split = input.data + input.length / (size_t)job.numChunks * (size_t)(i + 1);
+        if (i == job.numChunks - 1 || split <= p)
+            split = i == job.numChunks - 1 ? end : p;
+        else
+        {
+            split = memchr(split, '\n', (size_t)(end - split));
+            split = split ? split + 1 : end;
+        }
+        job.chunks[i].end = split;
+        p = split;
+    }
+    atomic_init(&job.nextChunk, 0);
+    job.d = d;
+
+    /*parse the chunks on a pool of threads*/
+    if (numThreads > job.numChunks)
+        numThreads = job.numChunks;
+    threads = malloc((size_t)numThreads * sizeof(pthread_t));
+    if (!threads)
+    {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 1; i < numThreads; i++)
+        if (pthread_create(&threads[i], NULL, ingestWorker, &job) != 0)
+        {
+            fprintf(stderr, "Error: cannot create thread\n");
+            exit(EXIT_FAILURE);
+        }
+    ingestWorker(&job);
+    for (i = 1; i < numThreads; i++)
+        pthread_join(threads[i], NULL);
+    free(threads);
+
+    /*gather the heaps in file order*/
+    for (i = 0; i < job.numChunks; i++)
+    {
+        lineNumber += job.chunks[i].lines;
+        if (job.chunks[i].error)
+        {
+            fprintf(stderr, "Error: invalid or out of range number on line %ld\n", lineNumber);
+            exit(EXIT_FAILURE);
+        }
+        if (job.chunks[i].numHeaps > INT_MAX - total)
+        {
+            fprintf(stderr, "Error: too many heaps\n");
+            exit(EXIT_FAILURE);
+        }
+        total += job.chunks[i].numHeaps;
+    }
+    heaps = malloc((size_t)(total ? total : 1) * sizeof(Heap));
+    if (!heaps)
+    {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    total = 0;
+    for (i = 0; i < job.numChunks; i++)
+    {
+        if (job.chunks[i].numHeaps > 0)
+            memcpy(&heaps[total], job.chunks[i].heaps, (size_t)job.chunks[i].numHeaps * sizeof(Heap));
+        total += job.chunks[i].numHeaps;
+        free(job.chunks[i].heaps);
+    }
+    free(job.chunks);
+
+    *numHeaps = total;
+    unmapInputFile(&input);
+    return heaps;
+}
+
+/**
+ * Loads the line offsets of an input file from its index file.
+ * @param index The index to fill in.
+ * @param indexName Name of the index file.
+ * @param info Status of the input file, the index is only used if it was made for this exact file.
+ * @return 1 if the offsets were loaded, 0 if there is no usable index file.
+ */
+int loadIndexFile(HeapIndex *index, const char *indexName, const struct stat *info)
+{
+    IndexFileHeader header;
+    FILE *file = fopen(indexName, "rb");
+    int i;
+
+    if (!file)
+        return 0;
+
+    if (fread(&header, sizeof(header), 1, file) != 1
+        || memcmp(header.magic, INDEX_FILE_MAGIC, sizeof(header.magic)) != 0
+        || header.fileSize != (int64_t)info->st_size
+        || header.modifiedSeconds != (int64_t)info->st_mtim.tv_sec
+        || header.modifiedNanoseconds != (int64_t)info->st_mtim.tv_nsec
+        || header.numHeaps < 0 || header.numHeaps > INT_MAX)
+    {
+        fclose(file);
+        return 0;
+    }
+
+    index->numHeaps = (int)header.numHeaps;
+    index->offsets = malloc((size_t)(index->numHeaps ? index->numHeaps : 1) * sizeof(uint64_t));
+    if (!index->offsets)
+    {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    if (fread(index->offsets, sizeof(uint64_t), (size_t)index->numHeaps, file) != (size_t)index->numHeaps)
+    {
+        free(index->offsets);
+        fclose(file);
+        return 0;
+    }
+    fclose(file);
+
+    for (i = 0; i < index->numHeaps; i++)
+        if (index->offsets[i] >= index->input.length)
+        {
+            free(index->offsets);
+            return 0;
+        }
+    return 1;
+}
+
+/**
+ * Saves the line offsets of an input file next to it, so the next run can skip the scan.
+ * Failing to write the index file is not an error, the index is simply rebuilt next time.
+ * @param index The index to save.
+ * @param indexName Name of the index file.
+ * @param info Status of the input file.
+ */
+void saveIndexFile(const HeapIndex *index, const char *indexName, const struct stat *info)
+{
+    IndexFileHeader header;
+    FILE *file = fopen(indexName, "wb");
+
+    if (!file)
+        return;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_FILE_MAGIC, sizeof(header.magic));
+    header.fileSize = (int64_t)info->st_size;
+    header.modifiedSeconds = (int64_t)info->st_mtim.tv_sec;
+    header.modifiedNanoseconds = (int64_t)info->st_mtim.tv_nsec;
+    header.numHeaps = index->numHeaps;
+
+    if (fwrite(&header, sizeof(header), 1, file) != 1
+        || fwrite(index->offsets, sizeof(uint64_t), (size_t)index->numHeaps, file) != (size_t)index->numHeaps)
+    {
+        fclose(file);
+        remove(indexName);
+        return;
+    }
+    if (fclose(file) != 0)
+        remove(indexName);
+}
+
+/**
+ * Opens a text input file for lazy loading.
+ * Only the offsets of the non-empty lines are collected, either from the index file next
+ * to the input or by one scan for newlines; no key is parsed until its heap is accessed.
+ * @param index The index to initialize.
+ * @param fileName Name of the file containing heap data.
+ */
+void openHeapIndex(HeapIndex *index, const char *fileName)
+{
+    char indexName[MAX_FILENAME_LENGTH + sizeof(INDEX_FILE_SUFFIX)];
+    struct stat info;
+    const char *p, *end, *lineEnd;
+    int capacity = 0;
+    int regular;
+
+    mapInputFile(&index->input, fileName);
+    regular = stat(fileName, &info) == 0 && S_ISREG(info.st_mode);
+    snprintf(indexName, sizeof(indexName), "%s%s", fileName, INDEX_FILE_SUFFIX);
+
+    if (!regular || !loadIndexFile(index, indexName, &info))
+    {
+        index->offsets = NULL;
+        index->numHeaps = 0;
+        p = index->input.data;
+        end = p + index->input.length;
+        while (p < end)
+        {
+            lineEnd = memchr(p, '\n', (size_t)(end - p));
+            if (!lineEnd)
+                lineEnd = end;
+
+            /*blank lines are skipped*/
+            while (p < lineEnd && isspace((unsigned char)*p))
+                p++;
+            if (p < lineEnd)
+            {
+                if (index->numHeaps == capacity)
+                {
+                    capacity = capacity ? capacity * 2 : 64;
+                    index->offsets = realloc(index->offsets, (size_t)capacity * sizeof(uint64_t));
+                    if (!index->offsets)
+                    {
+                        fprintf(stderr, "Error: out of memory\n");
+                        exit(EXIT_FAILURE);
+                    }
+                }
+                index->offsets[index->numHeaps++] = (uint64_t)(p - index->input.data);
+            }
+            p = lineEnd + 1;
+        }
+        if (regular)
+            saveIndexFile(index, indexName, &info);
+    }
+
+    index->heaps = malloc((size_t)(index->numHeaps ? index->numHeaps : 1) * sizeof(Heap));
+    index->loaded = calloc((size_t)(index->numHeaps ? index->numHeaps : 1), 1);
+    if (!index->heaps || !index->loaded)
+    {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Returns one heap of an indexed input file, parsing it the first time it is accessed.
+ * @param index The index of the input file.
+ * @param i Index of the heap, counting non-empty lines from 0.
+ * @param d The degree to build the heap with when it is first loaded, or 0 to keep the keys in file order.
+ * @return Pointer to the heap, owned by the index.
+ */
+Heap *getIndexedHeap(HeapIndex *index, int i, int d)
+{
+    const char *line = index->input.data + index->offsets[i];
+    const char *p;
+    long lineNumber = 1;
+
+    if (!index->loaded[i])
+    {
+        initHeap(&index->heaps[i], INITIAL_CAPACITY, d);
+        if (!parseHeapLine(line, index->input.data + index->input.length, &index->heaps[i]))
+        {
+            /*count lines only on the error path*/
+            for (p = index->input.data; p < line; p++)
+                lineNumber += *p == '\n';
+            fprintf(stderr, "Error: invalid or out of range number on line %ld\n", lineNumber);
+            exit(EXIT_FAILURE);
+        }
+        if (d > 0)
+            buildMaxHeap(&index->heaps[i]);
+        index->loaded[i] = 1;
+    }
+    return &index->heaps[i];
+}
+
+/**
+ * Prints one line of an indexed input file as it appears in the file, without parsing it.
+ * @param index The index of the input file.
+ * @param i Index of the heap, counting non-empty lines from 0.
+ */
+void printIndexedLine(const HeapIndex *index, int i)
+{
+    const char *line = index->input.data + index->offsets[i];
+    const char *end = index->input.data + index->input.length;
+    const char *lineEnd = memchr(line, '\n', (size_t)(end - line));
+
+    if (!lineEnd)
+        lineEnd = end;
+    while (lineEnd > line && isspace((unsigned char)lineEnd[-1]))
+        lineEnd--;
+    fwrite(line, 1, (size_t)(lineEnd - line), stdout);
+    printf("\n");
+}
+
+/**
+ * Releases an index and every heap loaded through it.
+ * @param index The index to close.
+ */
+void closeHeapIndex(HeapIndex *index)
+{
+    int i;
+    for (i = 0; i < index->numHeaps; i++)
+        if (index->loaded[i])
+            freeHeap(&index->heaps[i]);
+    free(index->heaps);
+    free(index->loaded);
+    free(index->offsets);
+    unmapInputFile(&index->input);
+}
+
+/**
+ * Writes a block of bytes to a descriptor, retrying after partial writes.
+ * @param fd The descriptor to write to.
+ * @param data The bytes to write.
+ * @param length Number of bytes to write.
+ */
+void writeAll(int fd, const void *data, size_t length)
+{
+    const char *bytes = data;
+    ssize_t count;
+
+    while (length > 0)
+    {
+        count = write(fd, bytes, length);
+        if (count < 0)
+        {
+            perror("Error writing output");
+            exit(EXIT_FAILURE);
+        }
+        bytes += count;
+        length -= (size_t)count;
+    }
+}
+
+/**
+ * Writes everything collected in an output buffer.
+ * @param out The output buffer.
+ */
+void flushOutput(OutputBuffer *out)
+{
+    writeAll(out->fd, out->data, out->length);
+    out->length = 0;
+}
+
+/**
+ * Appends bytes to an output buffer, writing it out whenever it fills up.
+ * Blocks at least as large as the buffer are written directly instead of being copied.
+ * @param out The output buffer.
+ * @param data The bytes to append.
+ * @param length Number of bytes to append.
+ */
+void writeOutput(OutputBuffer *out, const void *data, size_t length)
+{
+    if (length > sizeof(out->data) - out->length)
+    {
+        flushOutput(out);
+        if (length >= sizeof(out->data))
+        {
+            writeAll(out->fd, data, length);
+            return;
+        }
+    }
+    memcpy(out->data + out->length, data, length);
+    out->length += length;
+}
+
+/**
+ * Appends the decimal form of an integer to an output buffer.
+ * Digits are produced two at a time from a lookup table, without going through printf.
+ * @param out The output buffer.
+ * @param value The integer to append.
+ */
+void writeIntOutput(OutputBuffer *out, int value)
+{
+    static const char pairs[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+    char digits[12];
+    char *p = digits + sizeof(digits);
+    unsigned int n = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+
+    if (sizeof(out->data) - out->length < sizeof(digits))
+        flushOutput(out);
+
+    while (n >= 100)
+    {
+        p -= 2;
+        memcpy(p, pairs + (n % 100) * 2, 2);
+        n /= 100;
+    }
+    if (n >= 10)
+    {
+        p -= 2;
+        memcpy(p, pairs + n * 2, 2);
+    }
+    else
+        *--p = (char)('0' + n);
+    if (value < 0)
+        *--p = '-';
+
+    memcpy(out->data + out->length, p, (size_t)(digits + sizeof(digits) - p));
+    out->length += (size_t)(digits + sizeof(digits) - p);
+}
+
+/**
+ * Prints all elements of a heap.
+ * This is used for displaying the current state of a heap.
+ * @param heap Pointer to the heap to be printed.
+ */
+void printHeap(Heap *heap)
+{
+    printHeapRange(heap, 0, heap->size);
+}
+
+/**
+ * Prints the elements of a heap between two indexes.
+ * The numbers are formatted into one buffer and written with a single write() per buffer,
+ * so large heaps do not pay for a printf call per element.
+ * @param heap Pointer to the heap to be printed.
+ * @param from Index of the first element to print.
+ * @param to Index one past the last element to print, clamped to the size of the heap.
+ */
+void printHeapRange(Heap *heap, int from, int to)
+{
+    static OutputBuffer out;
+    int i;
+
+    if (to > heap->size)
+        to = heap->size;
+
+    /*anything printf() still holds must come out first*/
+    fflush(stdout);
+    out.fd = STDOUT_FILENO;
+    for (i = from; i < to; i++)
+    {
+        writeIntOutput(&out, heap->array[i]);
+        writeOutput(&out, " ", 1);
+    }
+    writeOutput(&out, "\n", 1);
+    flushOutput(&out);
+}
+
+/**
+ * Dumps the keys of a heap, in array order, to a file of raw int32 keys.
+ * The file can be opened again with openRawKeyFile().
+ * @param heap Pointer to the heap to dump.
+ * @param fileName Name of the file to write.
+ */
+void dumpHeapKeys(const Heap *heap, const char *fileName)
+{
+    int fd = open(fileName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0)
+    {
+        fprintf(stderr, "Error opening file.\n");
+        exit(EXIT_FAILURE);
+    }
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    {
+        uint32_t keys[1024];
+        int i, j, count;
+
+        for (i = 0; i < heap->size; i += count)
+        {
+            count = heap->size - i < 1024 ? heap->size - i : 1024;
+            for (j = 0; j < count; j++)
+                keys[j] = __builtin_bswap32((uint32_t)heap->array[i + j]);
+            writeAll(fd, keys, (size_t)count * sizeof(uint32_t));
+        }
+    }
+#else
+    writeAll(fd, heap->array, (size_t)heap->size * sizeof(int));
+#endif
+
+    if (close(fd) != 0)
+    {
+        fprintf(stderr, "Error writing file.\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Checks whether the keys of a heap satisfy the max-heap property.
+ * @param heap Pointer to the heap to check.
+ * @return 1 if every node is at least as large as its children, 0 otherwise.
+ */
+int isMaxHeap(const Heap *heap)
+{
+    int i;
+    for (i = 1; i < heap->size; i++)
+        if (heap->array[parent(i, heap->d)] < heap->array[i])
+            return 0;
+    return 1;
+}
+
+/**
+ * Checks whether a file starts with the binary heap file magic.
+ * @param fileName Name of the file to check.
+ * @return 1 if the file is a binary heap file, 0 otherwise.
+ */
+int isHeapFile(const char *fileName)
+{
+    char magic[sizeof(((HeapFileHeader *)0)->magic)];
+    FILE *file = fopen(fileName, "rb");
+    int result;
+
+    if (!file)
+        return 0;
+
+    result = fread(magic, 1, sizeof(magic), file) == sizeof(magic)
+             && memcmp(magic, HEAP_FILE_MAGIC, sizeof(magic)) == 0;
+    fclose(file);
+    return result;
+}
+
+/**
+ * Maps a binary heap file and uses its keys in place.
+ * Nothing is parsed or copied; if the header says the keys already form a max-heap the
+ * heap is ready in O(1), otherwise, as after a crash in the middle of an operation, it is
+ * built once and marked as ordered.
+ * Every change to the keys goes straight to the page cache of the file, unless the file is
+ * opened privately: then it is mapped read-only and copy-on-write, and changes stay in memory.
+ * @param heap Pointer to the heap to initialize.
+ * @param fileName Name of the binary heap file.
+ * @param isPrivate 1 to leave the file unchanged.
+ */
+void openHeapFile(Heap *heap, const char *fileName, int isPrivate)
+{
+    struct stat info;
+    HeapFileHeader *header;
+    int fd = open(fileName, isPrivate ? O_RDONLY : O_RDWR);
+
+    if (fd < 0 || fstat(fd, &info) != 0)
+    {
+        fprintf(stderr, "Error opening file.\n");
+        exit(EXIT_FAILURE);
+    }
+    if ((size_t)info.st_size < sizeof(HeapFileHeader))
+    {
+        fprintf(stderr, "Error: %s is not a heap file\n", fileName);
+        exit(EXIT_FAILURE);
+    }
+
+    header = mmap(NULL, (size_t)info.st_size, PROT_READ | PROT_WRITE, isPrivate ? MAP_PRIVATE : MAP_SHARED, fd, 0);
+    if (isPrivate)
+    {
+        close(fd);
+        fd = -1;
+    }
+    if (header == MAP_FAILED)
+    {
+        perror("Error mapping heap file");
+        exit(EXIT_FAILURE);
+    }
+
+    if (memcmp(header->magic, HEAP_FILE_MAGIC, sizeof(header->magic)) != 0
+        || header->version != HEAP_FILE_VERSION
+        || header->d < 1 || header->size < 0 || header->capacity < header->size
+        || sizeof(HeapFileHeader) + (size_t)header->capacity * sizeof(int) > (size_t)info.st_size)
+    {
+        fprintf(stderr, "Error: %s is not a valid heap file\n", fileName);
+        exit(EXIT_FAILURE);
+    }
+
+    heap->array = (int *)(header + 1);
+    heap->size = header->size;
+    heap->capacity = header->capacity;
+    heap->d = header->d;
+    heap->storage = isPrivate ? HEAP_STORAGE_PRIVATE_MAP : HEAP_STORAGE_FILE;
+    heap->header = header;
+    heap->mappedLength = (size_t)info.st_size;
+    heap->fd = fd;
+    heap->trace = NULL;
+    heap->log = NULL;
+    resetChanges(heap);
+    resetHeapStats(heap);
+
+    if (header->ordering != HEAP_MAX_ORDERED)
+        buildMaxHeap(heap);
+    syncHeapFile(heap);
+}
+
+/**
+ * Writes the size and degree of a mapped heap back into its file header and marks the keys
+ * as ordered again, see markHeapFileDirty(). Must only be called between operations.
+ * The keys themselves need no syncing since they live in the mapping.
+ * @param heap Pointer to the heap, nothing is done unless it is mapped from a file.
+ */
+void syncHeapFile(Heap *heap)
+{
+    if (heap->storage != HEAP_STORAGE_FILE)
+        return;
+
+    heap->header->d = heap->d;
+    heap->header->size = heap->size;
+    heap->header->capacity = heap->capacity;
+    heap->header->ordering = HEAP_MAX_ORDERED;
+}
+
+/**
+ * Writes a heap in the binary heap file format.
+ * @param heap Pointer to the heap to write.
+ * @param file The file to write to.
+ * @param progress Where the number of keys written so far is published every SNAPSHOT_CHUNK keys, or NULL.
+ * @return 0 on success, -1 if a write failed.
+ */
+int writeHeapFile(const Heap *heap, FILE *file, SnapshotProgress *progress)
+{
+    HeapFileHeader header;
+    long done, chunk;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, HEAP_FILE_MAGIC, sizeof(header.magic));
+    header.version = HEAP_FILE_VERSION;
+    header.d = heap->d;
+    header.size = heap->size;
+    header.capacity = heap->size;
+    header.ordering = heap->d >= 1 && isMaxHeap(heap) ? HEAP_MAX_ORDERED : HEAP_UNORDERED;
+
+    if (fwrite(&header, sizeof(header), 1, file) != 1)
+        return -1;
+    for (done = 0; done < heap->size; done += chunk)
+    {
+        chunk = heap->size - done < SNAPSHOT_CHUNK ? heap->size - done : SNAPSHOT_CHUNK;
+        if (fwrite(heap->array + done, sizeof(int), (size_t)chunk, file) != (size_t)chunk)
+            return -1;
+        if (progress)
+            atomic_store_explicit(&progress->written, done + chunk, memory_order_relaxed);
+    }
+    return 0;
+}
+
+/**
+ * Saves a heap to a binary heap file that can later be opened with openHeapFile().
+ * @param heap Pointer to the heap to save.
+ * @param fileName Name of the file to write.
+ */
+void saveHeapFile(const Heap *heap, const char *fileName)
+{
+    FILE *file = fopen(fileName, "wb");
+
+    if (!file)
+    {
+        fprintf(stderr, "Error opening file.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (writeHeapFile(heap, file, NULL) != 0 || fclose(file) != 0)
+    {
+        fprintf(stderr, "Error writing file.\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Opens a file of raw little-endian int32 keys and builds a heap directly on its mapping.
+ * The file is mapped copy-on-write, so there is no parse step and no copy into a separate
+ * array; only the pages that buildMaxHeap() writes to are duplicated, and the file is never changed.
+ * @param heap Pointer to the heap to initialize.
+ * @param fileName Name of the raw key file.
+ * @param d The degree of the heap, or 0 to keep the keys in file order.
+ */
+void openRawKeyFile(Heap *heap, const char *fileName, int d)
+{
+    struct stat info;
+    void *mapping;
+    int fd = open(fileName, O_RDONLY);
+
+    if (fd < 0 || fstat(fd, &info) != 0)
+    {
+        fprintf(stderr, "Error opening file.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (info.st_size % (off_t)sizeof(int32_t) != 0 || info.st_size / (off_t)sizeof(int32_t) > INT_MAX)
+    {
+        fprintf(stderr, "Error: %s is not a file of int32 keys\n", fileName);
+        exit(EXIT_FAILURE);
+    }
+    if (info.st_size == 0)
+    {
+        close(fd);
+        initHeap(heap, INITIAL_CAPACITY, d);
+        return;
+    }
+
+    mapping = mmap(NULL, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        perror("Error mapping key file");
+        exit(EXIT_FAILURE);
+    }
+
+    heap->array = mapping;
+    heap->size = (int)(info.st_size / (off_t)sizeof(int32_t));
+    heap->capacity = heap->size;
+    heap->d = d;
+    heap->storage = HEAP_STORAGE_PRIVATE_MAP;
+    heap->header = NULL;
+    heap->mappedLength = (size_t)info.st_size;
+    heap->fd = -1;
+    heap->trace = NULL;
+    heap->log = NULL;
+    resetChanges(heap);
+    resetHeapStats(heap);
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    {
+        int i;
+        for (i = 0; i < heap->size; i++)
+            heap->array[i] = (int)__builtin_bswap32((uint32_t)heap->array[i]);
+    }
+#endif
+
+    if (d > 0)
+        buildMaxHeap(heap);
+}
+
+/**
+ * Starts recording the operations of a heap to a trace file, which replay and tune can run
+ * again. The trace begins with the current keys of the heap; from then on insert, extract,
+ * increase-key, delete and insertMany() each append one record.
+ * @param heap The heap.
+ * @param fileName Name of the trace file, overwritten if it exists.
+ */
+void startTrace(Heap *heap, const char *fileName)
+{
+    TraceFileHeader header;
+    FILE *trace = fopen(fileName, "wb");
+
+    if (!trace || setvbuf(trace, NULL, _IOFBF, TRACE_BUFFER_SIZE) != 0)
+    {
+        perror("Error creating trace file");
+        exit(EXIT_FAILURE);
+    }
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_FILE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_FILE_VERSION;
+    header.d = heap->d;
+    fwrite(&header, sizeof(header), 1, trace);
+    heap->trace = trace;
+    traceKeys(heap, 'l', heap->array, heap->size);
+}
+
+/**
+ * Appends one operation to the trace of a heap.
+ * @param heap The heap, which must be recording a trace.
+ * @param op The operation: 'i', 'x', 'k' or 'd'.
+ * @param index Index of 'k' and 'd', ignored otherwise.
+ * @param key Key of 'i' and 'k', ignored otherwise.
+ */
+void traceOperation(Heap *heap, char op, int index, int key)
+{
+    char record[1 + 2 * sizeof(int32_t)];
+    size_t length = 1;
+    int32_t argument;
+
+    record[0] = op;
+    if (op == 'k' || op == 'd')
+    {
+        argument = index;
+        memcpy(record + length, &argument, sizeof(argument));
+        length += sizeof(argument);
+    }
+    if (op == 'i' || op == 'k')
+    {
+        argument = key;
+        memcpy(record + length, &argument, sizeof(argument));
+        length += sizeof(argument);
+    }
+    fwrite_unlocked(record, 1, length, heap->trace); /*a heap is only used by one thread at a time*/
+    if (heap->log)
+    {
+        heap->log->appended += length;
+        heap->log->dirty = 1;
+        commitHeapLog(heap, 0);
+    }
+}
+
+/**
+ * Appends an operation on many keys to the trace of a heap.
+ * @param heap The heap, which must be recording a trace.
+ * @param op The operation: 'l' for the starting keys, 'm' for insertMany().
+ * @param keys The keys.
+ * @param count Number of keys.
+ */
+void traceKeys(Heap *heap, char op, const int *keys, int count)
+{
+    int32_t length = count;
+    putc(op, heap->trace);
+    fwrite(&length, sizeof(length), 1, heap->trace);
+    fwrite(keys, sizeof(int), (size_t)count, heap->trace);
+    if (heap->log)
+    {
+        heap->log->appended += 1 + sizeof(length) + (uint64_t)count * sizeof(int);
+        heap->log->dirty = 1;
+        commitHeapLog(heap, 0);
+    }
+}
+
+/**
+ * Stops recording the operations of a heap and closes its trace file.
+ * @param heap The heap, which must be recording a trace.
+ */
+void stopTrace(Heap *heap)
+{
+    int failed = ferror(heap->trace);
+    if (fclose(heap->trace) != 0 || failed)
+    {
+        fprintf(stderr, "Error writing trace file\n");
+        exit(EXIT_FAILURE);
+    }
+    heap->trace = NULL;
+}
+
+/**
+ * Tells whether a file in memory is an operation trace.
+ * @param data The file.
+ * @param length Length of the file in bytes.
+ * @return 1 if the file starts with the header of a trace, 0 if not.
+ */
+int isTrace(const char *data, size_t length)
+{
+    return length >= sizeof(TraceFileHeader) && memcmp(data, TRACE_FILE_MAGIC, 8) == 0;
+}
+
+/**
+ * Reads an operation trace into an array of operations. Keys of the 'l' and 'm' records go
+ * into a separate pool: the starting keys first, then each 'm' operation has its offset in
+ * the pool as index and its count as key. A record cut short at the end of the file, as left
+ * by a process that was killed, is ignored with a warning; a negative index is an error.
+ * @param data The trace.
+ * @param length Length of the trace in bytes.
+ * @param ops Where to store the array of operations, to be freed by the caller.
+ * @param pool Where to store the key pool, to be freed by the caller.
+ * @param numInitial Where to store the number of starting keys, at the head of the pool.
+ * @param d Where to store the degree of the heap when the trace started.
+ * @return Number of operations.
+ */
+long readTrace(const char *data, size_t length, ScriptOp **ops, int **pool, int *numInitial, int *d)
+{
+    TraceFileHeader header;
+    size_t offset = sizeof(header), need;
+    long count = 0, capacity = 1024, poolSize = 0, poolCapacity = 1024;
+    int32_t arguments[2];
+    ScriptOp op;
+
+    memcpy(&header, data, sizeof(header));
+    if (header.version != TRACE_FILE_VERSION || header.d < 1)
+    {
+        fprintf(stderr, "Error: unsupported trace file\n");
+        exit(EXIT_FAILURE);
+    }
+    *d = header.d;
+    *numInitial = 0;
+    *ops = malloc((size_t)capacity * sizeof(ScriptOp));
+    *pool = malloc((size_t)poolCapacity * sizeof(int));
+
+    while (*ops && *pool && offset < length)
+    {
+        op.op = data[offset];
+        op.index = op.key = 0;
+        if (!strchr("ixkdml", op.op) || op.op == '\0' || (op.op == 'l') != (offset == sizeof(header)))
+        {
+            fprintf(stderr, "Error: invalid trace record at byte %zu\n", offset);
+            exit(EXIT_FAILURE);
+        }
+        need = 1 + sizeof(int32_t) * (size_t)((op.op == 'k') + (op.op != 'x'));
+        if (length - offset < need)
+            break;
+        memcpy(arguments, data + offset + 1, need - 1);
+        if (op.op == 'k' || op.op == 'd')
+            op.index = arguments[0];
+        if (op.index < 0)
+        {
+            fprintf(stderr, "Error: invalid trace record at byte %zu\n", offset);
+            exit(EXIT_FAILURE);
+        }
+        if (op.op == 'i' || op.op == 'k')
+            op.key = arguments[op.op == 'k'];
+        if (op.op == 'l' || op.op == 'm')
+        {
+            /*the keys go into the pool*/
+            op.key = arguments[0];
+            op.index = (int)poolSize;
+            if (op.key < 0 || (length - offset - need) / sizeof(int32_t) < (size_t)op.key)
+                break;
+            if (op.key > INT_MAX - poolSize)
+            {
+                fprintf(stderr, "Error: trace is too large\n");
+                exit(EXIT_FAILURE);
+            }
+            if (poolSize + op.key > poolCapacity)
+            {
+                while (poolSize + op.key > poolCapacity)
+                    poolCapacity *= 2;
+                *pool = realloc(*pool, (size_t)poolCapacity * sizeof(int));
+                if (!*pool)
+                    break;
+            }
+            memcpy(*pool + poolSize, data + offset + need, (size_t)op.key * sizeof(int32_t));
+            poolSize += op.key;
+            need += (size_t)op.key * sizeof(int32_t);
+        }
+        offset += need;
+        if (op.op == 'l')
+        {
+            *numInitial = op.key;
+            continue;
+        }
+
+        if (count == capacity)
+        {
+            capacity *= 2;
+            *ops = realloc(*ops, (size_t)capacity * sizeof(ScriptOp));
+            if (!*ops)
+                break;
+        }
+        (*ops)[count++] = op;
+    }
+    if (!*ops || !*pool)
+    {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    if (offset < length)
+        fprintf(stderr, "Warning: ignoring an incomplete record at byte %zu of the trace\n", offset);
+    return count;
+}
+
+/**
+ * Makes a rename or creation of a file durable by syncing the directory that holds it.
+ * @param fileName Name of the file.
+ * @return 0 on success, -1 on failure with errno set.
+ */
+int syncParentDirectory(const char *fileName)
+{
+    char directory[MAX_FILENAME_LENGTH + 16];
+    const char *slash = strrchr(fileName, '/');
+    int fd;
+
+    if (slash)
+        snprintf(directory, sizeof(directory), "%.*s", (int)(slash - fileName + 1), fileName);
+    else
+        strcpy(directory, ".");
+    fd = open(directory, O_RDONLY | O_DIRECTORY);
+    if (fd < 0)
+        return -1;
+    if (fsync(fd) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return close(fd);
+}
+
+/**
+ * Makes a heap durable with a write-ahead log. The log is a trace (see startTrace()) that begins
+ * with a snapshot of the keys; every later operation appends a record, and records are synced
+ * in groups: a record waits at most syncMs milliseconds, or is synced at once if syncMs is 0.
+ * After a crash, recoverHeapLog() rebuilds the heap from the log.
+ * @param heap The heap, which must not be recording a trace.
+ * @param fileName Name of the log, replaced if it exists.
+ * @param syncMs Milliseconds a record may wait for its sync.
+ */
+void startHeapLog(Heap *heap, const char *fileName, long syncMs)
+{
+    HeapLog *log = calloc(1, sizeof(HeapLog));
+    if (!log)
+    {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    if (snprintf(log->fileName, sizeof(log->fileName), "%s", fileName) >= (int)sizeof(log->fileName))
+    {
+        fprintf(stderr, "Error: log file name is too long\n");
+        exit(EXIT_FAILURE);
+    }
+    log->syncInterval = (uint64_t)syncMs * 1000000u;
+    heap->log = log;
+    checkpointHeapLog(heap);
+}
+
+/**
+ * Replaces the write-ahead log of a heap by a new one holding just a snapshot of the current
+ * keys, so the log stops growing and recovery gets faster. Needed as well after anything that
+ * the log does not record, such as a change of degree. The new log is written and synced
+ * under a temporary name and then renamed over the old one, so a crash leaves one or the other.
+ * @param heap The heap, which must have a write-ahead log.
+ */
+void checkpointHeapLog(Heap *heap)
+{
+    HeapLog *log = heap->log;
+    char tempName[MAX_FILENAME_LENGTH + 32];
+
+    /*the old log stays complete and durable until the new one replaces it*/
+    if (heap->trace)
+    {
+        commitHeapLog(heap, 1);
+        stopTrace(heap);
+    }
+    heap->log = NULL;
+    snprintf(tempName, sizeof(tempName), "%s.tmp", log->fileName);
+    startTrace(heap, tempName);
+    heap->log = log;
+    log->appended = 0;
+    commitHeapLog(heap, 1);
+    if (rename(tempName, log->fileName) != 0)
+    {
+        perror("Error replacing write-ahead log");
+        exit(EXIT_FAILURE);
+    }
+    if (syncParentDirectory(log->fileName) != 0)
+    {
+        perror("Error syncing directory");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Checkpoints the write-ahead log of a heap once its records take more than WAL_CHECKPOINT_BYTES
+ * and more than the snapshot would, so the log stays below about twice the heap plus that much
+ * and the cost of the checkpoint is spread over the records. Call it between two operations.
+ * @param heap The heap, which must have a write-ahead log.
+ */
+void trimHeapLog(Heap *heap)
+{
+    if (heap->log->appended > WAL_CHECKPOINT_BYTES && heap->log->appended > (uint64_t)heap->size * sizeof(int))
+        checkpointHeapLog(heap);
+}
+
+/**
+ * Syncs the records of a write-ahead log that have waited long enough, or all of them.
+ * This is the group commit: all records written since the last sync share one fdatasync().
+ * @param heap The heap, which must have a write-ahead log.
+ * @param force 1 to sync now, 0 to sync only if the oldest unsynced record waited syncInterval.
+ */
+void commitHeapLog(Heap *heap, int force)
+{
+    HeapLog *log = heap->log;
+    struct timespec now;
+    uint64_t nanoseconds;
+
+    if (!log->dirty && !force)
+        return;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now); /*a few nanoseconds, it is read for every record*/
+    nanoseconds = (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+    if (!force && nanoseconds - log->lastSync < log->syncInterval)
+        return;
+
+    if (fflush(heap->trace) != 0 || fdatasync(fileno(heap->trace)) != 0)
+    {
+        perror("Error syncing write-ahead log");
+        exit(EXIT_FAILURE);
+    }
+    log->lastSync = nanoseconds;
+    log->dirty = 0;
+    log->syncs++;
+}
+
+/**
+ * Syncs and closes the write-ahead log of a heap. The log stays on disk for recoverHeapLog().
+ * @param heap The heap, which must have a write-ahead log.
+ */
+void stopHeapLog(Heap *heap)
+{
+    commitHeapLog(heap, 1);
+    free(heap->log);
+    heap->log = NULL;
+    stopTrace(heap);
+}
+
+/**
+ * Rebuilds a heap from its write-ahead log: the snapshot at the head of the log is loaded and
+ * the records after it are replayed, which gives back the same keys in the same places. A
+ * record cut short by the crash is dropped. Every degree the heap can have, 1 included, is
+ * recovered with it. The heap does not log; call startHeapLog() next.
+ * @param heap The heap to initialize.
+ * @param fileName Name of the log.
+ * @return 1 if the heap was recovered, 0 if there is no log.
+ */
+int recoverHeapLog(Heap *heap, const char *fileName)
+{
+    InputFile input;
+    ScriptOp *ops;
+    long count, skipped;
+    int *pool, numInitial, d;
+
+    if (access(fileName, F_OK) != 0)
+        return 0;
+    mapInputFile(&input, fileName);
+    if (!isTrace(input.data, input.length))
+    {
+        fprintf(stderr, "Error: %s is not a write-ahead log\n", fileName);
+        exit(EXIT_FAILURE);
+    }
+    count = readTrace(input.data, input.length, &ops, &pool, &numInitial, &d);
+    unmapInputFile(&input);
+
+    initHeap(heap, numInitial, d);
+    memcpy(heap->array, pool, (size_t)numInitial * sizeof(int));
+    heap->size = numInitial;
+    skipped = replayScript(heap, ops, count, pool, NULL);
+    if (skipped > 0)
+        fprintf(stderr, "Warning: %ld records of %s did not apply\n", skipped, fileName);
+    resetChanges(heap);
+    free(ops);
+    free(pool);
+    return 1;
+}
+
+/**
+ * Looks for a write-ahead log PREFIX.N with N above a given id, which recovery would not reach.
+ * @param prefix Start of the log file names.
+ * @param id The first missing id.
+ * @return The lowest such N, or -1 if there is none.
+ */
+int findLaterLog(const char *prefix, int id)
+{
+    const char *base = strrchr(prefix, '/');
+    char directory[MAX_FILENAME_LENGTH + 1], *end;
+    struct dirent *entry;
+    size_t baseLength;
+    long n;
+    int found = -1;
+    DIR *dir;
+
+    if (base)
+        snprintf(directory, sizeof(directory), "%.*s", (int)(base - prefix + 1), prefix);
+    else
+        strcpy(directory, ".");
+    base = base ? base + 1 : prefix;
+    baseLength = strlen(base);
+    dir = opendir(directory);
+    if (!dir)
+        return -1;
+    while ((entry = readdir(dir)))
+    {
+        if (strncmp(entry->d_name, base, baseLength) != 0 || entry->d_name[baseLength] != '.'
+            || !isdigit((unsigned char)entry->d_name[baseLength + 1]))
+            continue;
+        n = strtol(entry->d_name + baseLength + 1, &end, 10);
+        if (*end == '\0' && n > id && n <= INT_MAX && (found < 0 || n < found))
+            found = (int)n;
+    }
+    closedir(dir);
+    return found;
+}
+
+/**
+ * Prompts the user for integer input within a specified range.
+ * This function ensures that user input is valid and within the required bounds.
  * @param prompt The prompt message to display to the user.
  * @param min Minimum allowable value.
  * @param max Maximum allowable value.
  * @return The validated integer input from the user.
  */
-int getIntInput(const char *prompt, int min, int max)
+int getIntInput(const char *prompt, int min, int max)
+{
+    char input[100];
+    int number;
+    while (1) 
+    {
+        printf("%s", prompt);
+        scanf("%s", input);
+
+        if (isNumber(input))
+        {
+            number = atoi(input);
+            if (number >= min && number <= max)
+                return number;
+        }
+        printf("Invalid input. Please enter a number between %d and %d.\n", min, max);
+    }
+}
+
+/**
+ * Reads a monotonic clock.
+ * @return The current time in nanoseconds from an arbitrary starting point.
+ */
+uint64_t nowNanoseconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+/**
+ * Finds the histogram bucket of a latency. Below LATENCY_SUB_BUCKETS every value has its own
+ * bucket; above, each power of two is split into LATENCY_SUB_BUCKETS equal buckets.
+ * @param nanoseconds The latency.
+ * @return Index of the bucket, below LATENCY_BUCKETS.
+ */
+int latencyBucket(uint64_t nanoseconds)
+{
+    int exponent;
+    if (nanoseconds < LATENCY_SUB_BUCKETS)
+        return (int)nanoseconds;
+    exponent = 63 - __builtin_clzll(nanoseconds);
+    return (exponent - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS
+           + (int)((nanoseconds >> (exponent - LATENCY_SUB_BITS)) & (LATENCY_SUB_BUCKETS - 1));
+}
+
+/**
+ * Finds the largest latency that falls in a histogram bucket.
+ * @param bucket Index of the bucket.
+ * @return The largest latency of the bucket, in nanoseconds.
+ */
+uint64_t latencyBucketLimit(int bucket)
+{
+    int shift;
+    if (bucket < LATENCY_SUB_BUCKETS)
+        return (uint64_t)bucket;
+    shift = bucket / LATENCY_SUB_BUCKETS - 1;
+    return (((uint64_t)(LATENCY_SUB_BUCKETS + bucket % LATENCY_SUB_BUCKETS) + 1) << shift) - 1;
+}
+
+/**
+ * Adds one latency to a histogram.
+ * @param histogram The histogram.
+ * @param nanoseconds The latency.
+ */
+void recordLatency(LatencyHistogram *histogram, uint64_t nanoseconds)
+{
+    histogram->counts[latencyBucket(nanoseconds)]++;
+    histogram->total++;
+    if (nanoseconds > histogram->max)
+        histogram->max = nanoseconds;
+}
+
+/**
+ * Finds a percentile of the latencies of a histogram, rounded up to the end of its bucket.
+ * @param histogram The histogram.
+ * @param fraction Share of the latencies that are at most the result, 0.99 for p99.
+ * @return The percentile in nanoseconds, never more than the largest latency, 0 if the histogram is empty.
+ */
+uint64_t latencyPercentile(const LatencyHistogram *histogram, double fraction)
+{
+    long long rank = (long long)(fraction * histogram->total + 0.5), seen = 0;
+    int bucket;
+    if (rank < 1)
+        rank = 1;
+    for (bucket = 0; bucket < LATENCY_BUCKETS; bucket++)
+    {
+        seen += histogram->counts[bucket];
+        if (seen >= rank)
+            return latencyBucketLimit(bucket) < histogram->max ? latencyBucketLimit(bucket) : histogram->max;
+    }
+    return histogram->max;
+}
+
+/**
+ * Prepares empty latency histograms for a batch script.
+ * @param recorder The histograms to initialize.
+ * @param sampleEvery Time one operation in this many of each kind, 1 to time them all.
+ */
+void initLatencyRecorder(LatencyRecorder *recorder, int sampleEvery)
+{
+    size_t i;
+    memset(recorder, 0, sizeof(*recorder));
+    recorder->sampleEvery = sampleEvery;
+    for (i = 0; i < sizeof(LATENCY_OPS) - 1; i++)
+        recorder->countdown[i] = 1; /*the first operation of each kind is timed*/
+}
+
+/**
+ * Decides whether to time an operation: one in sampleEvery of each kind is timed.
+ * @param recorder The histograms, or NULL if nothing is timed.
+ * @param op The operation, a character of LATENCY_OPS or another one that is never timed.
+ * @return Position of the histogram of the operation if it is to be timed, -1 if not.
+ */
+int sampleLatency(LatencyRecorder *recorder, char op)
+{
+    const char *kind;
+    if (!recorder || op == '\0' || !(kind = strchr(LATENCY_OPS, op)))
+        return -1;
+    if (--recorder->countdown[kind - LATENCY_OPS] > 0)
+        return -1;
+    recorder->countdown[kind - LATENCY_OPS] = recorder->sampleEvery;
+    return (int)(kind - LATENCY_OPS);
+}
+
+/**
+ * Adds up the latency histograms of all operations.
+ * @param recorder The histograms.
+ * @param all Where to store their sum.
+ */
+void mergeLatencies(const LatencyRecorder *recorder, LatencyHistogram *all)
+{
+    size_t i;
+    int bucket;
+
+    memset(all, 0, sizeof(*all));
+    for (i = 0; i < sizeof(LATENCY_OPS) - 1; i++)
+    {
+        for (bucket = 0; bucket < LATENCY_BUCKETS; bucket++)
+            all->counts[bucket] += recorder->histograms[i].counts[bucket];
+        all->total += recorder->histograms[i].total;
+        if (recorder->histograms[i].max > all->max)
+            all->max = recorder->histograms[i].max;
+    }
+}
+
+/**
+ * Prints the percentiles of the latency histograms of a batch script, one line per operation.
+ * The latencies include the cost of reading the clock twice.
+ * @param recorder The histograms.
+ * @param out Where to print.
+ */
+void printLatencies(const LatencyRecorder *recorder, FILE *out)
+{
+    static const char *names[] = {"insert", "extract", "increase", "delete"};
+    const LatencyHistogram *histogram;
+    size_t i;
+
+    fprintf(out, "Latency ns (1 in %d operations timed):\n", recorder->sampleEvery);
+    for (i = 0; i < sizeof(LATENCY_OPS) - 1; i++)
+    {
+        histogram = &recorder->histograms[i];
+        if (histogram->total == 0)
+            continue;
+        fprintf(out, "  %-8s n %lld  p50 %llu  p99 %llu  p999 %llu  max %llu\n", names[i], histogram->total,
+                (unsigned long long)latencyPercentile(histogram, 0.5),
+                (unsigned long long)latencyPercentile(histogram, 0.99),
+                (unsigned long long)latencyPercentile(histogram, 0.999),
+                (unsigned long long)histogram->max);
+    }
+}
+
+/**
+ * Loads one heap from any of the supported input files, for the non-interactive modes.
+ * The file is never changed: a binary heap file is mapped copy-on-write like a raw key file.
+ * @param heap Pointer to the heap to initialize.
+ * @param fileName A text file of arrays, a binary heap file or, with isRaw, a raw key file.
+ * @param heapNumber Which array of a text file to load, counting from 1.
+ * @param d The degree of the heap, or 0 to keep the degree stored in a binary heap file and
+ *          the keys of other files in file order, not yet a heap.
+ * @param isRaw 1 if fileName holds raw int32 keys.
+ */
+void loadHeap(Heap *heap, const char *fileName, int heapNumber, int d, int isRaw)
+{
+    HeapIndex heapIndex;
+
+    if (isRaw)
+        openRawKeyFile(heap, fileName, d);
+    else if (isHeapFile(fileName))
+    {
+        openHeapFile(heap, fileName, 1);
+        if (d > 0 && d != heap->d)
+        {
+            heap->d = d;
+            buildMaxHeap(heap);
+        }
+    }
+    else
+    {
+        openHeapIndex(&heapIndex, fileName);
+        if (heapNumber < 1 || heapNumber > heapIndex.numHeaps)
+        {
+            fprintf(stderr, "Error: %s has no array %d\n", fileName, heapNumber);
+            exit(EXIT_FAILURE);
+        }
+
+        /*take the heap over from the index before closing it*/
+        *heap = *getIndexedHeap(&heapIndex, heapNumber - 1, d);
+        heapIndex.loaded[heapNumber - 1] = 0;
+        closeHeapIndex(&heapIndex);
+    }
+    resetChanges(heap);
+}
+
+/**
+ * Skips spaces and tabs, but not the end of a line.
+ * @param p Current position.
+ * @param end End of the buffer.
+ * @return Pointer to the first character that is not a blank.
+ */
+const char *skipBlanks(const char *p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+        p++;
+    return p;
+}
+
+/**
+ * Executes one line of an operations script.
+ * A line is one of "i KEY" (insert), "x" (extract max), "k INDEX KEY" (increase key),
+ * "d INDEX" (delete) or "p" (print the heap); blank lines and lines starting with '#' are ignored.
+ * @param heap The heap to operate on.
+ * @param p First character of the line.
+ * @param end One past the last character of the line, not including the newline.
+ * @param lineNumber Number of the line, used for error messages.
+ * @param stats Counters to update.
+ * @param latency Histograms to record the latency of the operation in, or NULL not to time it.
+ */
+void executeScriptLine(Heap *heap, const char *p, const char *end, long lineNumber, BatchStats *stats,
+                       LatencyRecorder *latency)
+{
+    uint64_t begin = 0;
+    char op;
+    int index = 0, key = 0, timed;
+
+    p = skipBlanks(p, end);
+    if (p == end || *p == '#')
+        return;
+    op = *p++;
+
+    /*read the arguments the operation takes*/
+    if (op == 'k' || op == 'd')
+    {
+        p = parseInt(skipBlanks(p, end), end, &index);
+        if (p && (index < 0 || index >= heap->size))
+        {
+            fprintf(stderr, "Error: index %d out of bounds on line %ld\n", index, lineNumber);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (p && (op == 'i' || op == 'k'))
+        p = parseInt(skipBlanks(p, end), end, &key);
+    if (!p || skipBlanks(p, end) != end || op == '\0' || !strchr("ixkdp", op))
+    {
+        fprintf(stderr, "Error: invalid operation on line %ld\n", lineNumber);
+        exit(EXIT_FAILURE);
+    }
+    if (op == 'k' && key < heap->array[index])
+    {
+        fprintf(stderr, "Error: new key is smaller than current key on line %ld\n", lineNumber);
+        exit(EXIT_FAILURE);
+    }
+
+    timed = sampleLatency(latency, op);
+    if (timed >= 0)
+        begin = nowNanoseconds();
+
+    switch (op)
+    {
+        case 'i':
+            insert(heap, key);
+            stats->inserts++;
+            break;
+        case 'x':
+            if (heap->size > 0)
+            {
+                stats->checksum += heapExtractMax(heap);
+                stats->extracts++;
+            }
+            else
+                stats->emptyExtracts++;
+            break;
+        case 'k':
+            increaseKey(heap, index, key);
+            stats->increases++;
+            break;
+        case 'd':
+            delete(heap, index);
+            stats->deletes++;
+            break;
+        case 'p':
+            printHeap(heap);
+            stats->prints++;
+            break;
+    }
+
+    if (timed >= 0)
+        recordLatency(&latency->histograms[timed], nowNanoseconds() - begin);
+}
+
+/**
+ * Runs a script of heap operations without prompts or per-operation printing,
+ * then reports how many operations of each kind ran and how long they took.
+ * Usage: batch [-d D] [-h N] [-r] [-p] [-a] [-t TRACE | -w LOG [-f SYNC_MS]] [-s] [-l SAMPLE] FILE [SCRIPT]
+ * The heap is array N (default 1) of FILE built with degree D (default 2); the script is
+ * read from SCRIPT, or from standard input when it is missing or "-". With -p the final heap is printed,
+ * with -s the operation counters of the heap (see printHeapStats()). With -l one operation in SAMPLE
+ * of each kind is timed, and the latency percentiles of each kind are printed. With -t the
+ * operations are recorded to the trace file TRACE; -a cannot be used with it, since a trace
+ * does not record the rebuilds. With -w they go to the write-ahead log LOG, synced every SYNC_MS
+ * milliseconds (default WAL_SYNC_MS); if LOG exists, the heap is recovered from it instead of FILE.
+ * With -a the degree adapts to the operation mix: every ADAPT_WINDOW operations the mix of
+ * the window is looked at, and the heap is rebuilt with a better degree if there is one.
+ * @param argc Number of arguments, argv[0] being "batch".
+ * @param argv The arguments.
+ * @return The exit status of the program.
+ */
+int runBatch(int argc, const char *argv[])
+{
+    Heap heap;
+    BatchStats stats, window;
+    LatencyRecorder *latency = NULL;
+    const char *fileName = NULL, *scriptName = NULL, *traceName = NULL, *logName = NULL;
+    const char *p, *lineEnd, *end;
+    char *buffer;
+    size_t length = 0;
+    ssize_t count = 1;
+    long lineNumber = 0;
+    long operations;
+    uint64_t loadStart, runStart, runEnd;
+    int d = 0, heapNumber = 1, isRaw = 0, printFinal = 0, adaptive = 0, printStats = 0, rebuilds = 0;
+    int initialSize, initialD, newD, sampleEvery = 0, recovered = 0;
+    long syncMs = WAL_SYNC_MS;
+    int fd = STDIN_FILENO;
+    int i;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-d") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            d = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-h") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            heapNumber = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-r") == 0)
+            isRaw = 1;
+        else if (strcmp(argv[i], "-p") == 0)
+            printFinal = 1;
+        else if (strcmp(argv[i], "-a") == 0)
+            adaptive = 1;
+        else if (strcmp(argv[i], "-s") == 0)
+            printStats = 1;
+        else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            sampleEvery = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+            traceName = argv[++i];
+        else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc)
+            logName = argv[++i];
+        else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc && atol(argv[i + 1]) >= 0)
+            syncMs = atol(argv[++i]);
+        else if ((argv[i][0] != '-' || strcmp(argv[i], "-") == 0) && !fileName)
+            fileName = argv[i];
+        else if ((argv[i][0] != '-' || strcmp(argv[i], "-") == 0) && !scriptName)
+            scriptName = argv[i];
+        else
+            break;
+    }
+    if (i < argc || !fileName || (traceName && (adaptive || logName)))
+    {
+        fprintf(stderr, "Usage: batch [-d D] [-h N] [-r] [-p] [-a] [-t TRACE | -w LOG [-f SYNC_MS]] [-s] [-l SAMPLE] FILE [SCRIPT]\n");
+        return EXIT_FAILURE;
+    }
+
+    loadStart = nowNanoseconds();
+    if (logName)
+        recovered = recoverHeapLog(&heap, logName);
+    if (!recovered)
+        loadHeap(&heap, fileName, heapNumber, d ? d : (isRaw || !isHeapFile(fileName) ? 2 : 0), isRaw);
+    initialSize = heap.size;
+    initialD = heap.d;
+    resetHeapStats(&heap); /*count the script only, not the initial build*/
+    if (traceName)
+        startTrace(&heap, traceName);
+    if (logName)
+        startHeapLog(&heap, logName, syncMs);
+
+    if (scriptName && strcmp(scriptName, "-") != 0)
+    {
+        fd = open(scriptName, O_RDONLY);
+        if (fd < 0)
+        {
+            fprintf(stderr, "Error opening file.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    buffer = malloc(SCRIPT_BUFFER_SIZE);
+    if (!buffer)
+    {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(&stats, 0, sizeof(stats));
+    window = stats;
+    if (sampleEvery)
+    {
+        latency = malloc(sizeof(*latency));
+        if (!latency)
+        {
+            fprintf(stderr, "Error: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        initLatencyRecorder(latency, sampleEvery);
+    }
+
+    /*stream the script through the buffer one block at a time*/
+    runStart = nowNanoseconds();
+    while (count > 0)
+    {
+        count = read(fd, buffer + length, SCRIPT_BUFFER_SIZE - length);
+        if (count < 0)
+        {
+            perror("Error reading script");
+            exit(EXIT_FAILURE);
+        }
+        length += (size_t)count;
+        end = buffer + length;
+
+        p = buffer;
+        while ((lineEnd = memchr(p, '\n', (size_t)(end - p))) || (count == 0 && p < end))
+        {
+            if (!lineEnd)
+                lineEnd = end;
+            executeScriptLine(&heap, p, lineEnd, ++lineNumber, &stats, latency);
+            p = lineEnd < end ? lineEnd + 1 : end;
+            if (heap.log)
+                trimHeapLog(&heap);
+
+            /*look at the mix of the last window and move to a better degree*/
+            if (adaptive && stats.inserts + stats.extracts + stats.increases + stats.deletes
+                            - window.inserts - window.extracts - window.increases - window.deletes >= ADAPT_WINDOW)
+            {
+                newD = chooseDegree(stats.inserts - window.inserts + stats.increases - window.increases
+                                    + stats.deletes - window.deletes,
+                                    stats.extracts - window.extracts + stats.deletes - window.deletes,
+                                    heap.size, heap.d);
+                if (newD != heap.d)
+                {
+                    rebuildHeap(&heap, newD);
+                    rebuilds++;
+                    if (heap.log)
+                        checkpointHeapLog(&heap); /*the log cannot replay a change of degree*/
+                }
+                window = stats;
+            }
+        }
+
+        /*keep the unfinished last line for the next block*/
+        length = (size_t)(end - p);
+        memmove(buffer, p, length);
+        if (length == SCRIPT_BUFFER_SIZE)
+        {
+            fprintf(stderr, "Error: line %ld is too long\n", lineNumber + 1);
+            exit(EXIT_FAILURE);
+        }
+    }
+    runEnd = nowNanoseconds();
+
+    if (printFinal)
+        printHeap(&heap);
+
+    operations = stats.inserts + stats.extracts + stats.emptyExtracts + stats.increases + stats.deletes;
+    printf("%s %d keys with d=%d in %.3f ms\n", recovered ? "Recovered" : "Loaded", initialSize, initialD,
+           (runStart - loadStart) / 1e6);
+    printf("Executed %ld operations in %.3f ms (%.0f ns/op, %.2f M ops/s)\n", operations,
+           (runEnd - runStart) / 1e6, operations ? (double)(runEnd - runStart) / operations : 0.0,
+           runEnd > runStart ? operations * 1e3 / (double)(runEnd - runStart) : 0.0);
+    printf("  inserts: %ld\n  extracts: %ld (%ld on an empty heap)\n  increases: %ld\n  deletes: %ld\n",
+           stats.inserts, stats.extracts, stats.emptyExtracts, stats.increases, stats.deletes);
+    if (adaptive)
+        printf("Rebuilt %d times, final d=%d\n", rebuilds, heap.d);
+    if (heap.log)
+        printf("Write-ahead log synced %ld times\n", heap.log->syncs);
+    printf("Final size: %d", heap.size);
+    if (heap.size > 0)
+        printf(", max: %d", heap.array[ROOT]);
+    printf(", extracted sum: %ld\n", stats.checksum);
+    if (printStats)
+        printHeapStats(&heap, stdout);
+    if (latency)
+        printLatencies(latency, stdout);
+
+    if (fd != STDIN_FILENO)
+        close(fd);
+    free(latency);
+    free(buffer);
+    freeHeap(&heap);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Adds an empty heap to a heap table.
+ * @param table The heap table.
+ * @param d The degree of the new heap.
+ * @return The id of the new heap.
+ */
+int createTableHeap(HeapTable *table, int d)
+{
+    if (table->numHeaps == table->capacity)
+    {
+        table->capacity = table->capacity ? table->capacity * 2 : 16;
+        table->heaps = realloc(table->heaps, (size_t)table->capacity * sizeof(Heap));
+        if (!table->heaps)
+        {
+            fprintf(stderr, "Error: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    initHeap(&table->heaps[table->numHeaps], INITIAL_CAPACITY, d);
+    if (table->tracePrefix)
+        startTableTrace(table, table->numHeaps);
+    return table->numHeaps++;
+}
+
+/**
+ * Executes one binary protocol request.
+ * Unlike the interactive program, bad requests never end the process; they get an error status.
+ * @param table The heaps to operate on.
+ * @param request The request.
+ * @param response The response to fill in.
+ */
+void executeRequest(HeapTable *table, const ProtocolRequest *request, ProtocolResponse *response)
+{
+    Heap *heap = NULL;
+
+    memset(response, 0, sizeof(*response));
+    response->opcode = request->opcode;
+    response->heapId = request->heapId;
+
+    if (request->opcode == OP_CREATE)
+    {
+        if (request->key < 1)
+            response->status = STATUS_BAD_KEY;
+        else
+            response->heapId = (uint32_t)createTableHeap(table, request->key);
+        return;
+    }
+    if (request->opcode == OP_SNAPSHOT_STATUS)
+    {
+        static const uint8_t statuses[] = {STATUS_EMPTY, STATUS_BUSY, STATUS_OK, STATUS_FAILED};
+        response->status = statuses[pollSnapshot(table, 0)];
+        response->heapId = (uint32_t)table->snapshot.heapId;
+        if (table->snapshot.progress)
+        {
+            response->value = (int32_t)atomic_load_explicit(&table->snapshot.progress->written, memory_order_relaxed);
+            response->size = (int32_t)table->snapshot.progress->total;
+        }
+        return;
+    }
+
+    if (request->heapId >= (uint32_t)table->numHeaps)
+    {
+        response->status = STATUS_BAD_HEAP;
+        return;
+    }
+    heap = &table->heaps[request->heapId];
+
+    switch (request->opcode)
+    {
+        case OP_INSERT:
+            insert(heap, request->key);
+            break;
+        case OP_EXTRACT_MAX:
+            if (heap->size > 0)
+                response->value = heapExtractMax(heap);
+            else
+                response->status = STATUS_EMPTY;
+            break;
+        case OP_INCREASE_KEY:
+            if (request->index < 0 || request->index >= heap->size)
+                response->status = STATUS_BAD_INDEX;
+            else if (request->key < heap->array[request->index])
+                response->status = STATUS_BAD_KEY;
+            else
+                increaseKey(heap, request->index, request->key);
+            break;
+        case OP_DELETE:
+            if (request->index < 0 || request->index >= heap->size)
+                response->status = STATUS_BAD_INDEX;
+            else
+                delete(heap, request->index);
+            break;
+        case OP_MAX:
+            if (heap->size > 0)
+                response->value = heap->array[ROOT];
+            else
+                response->status = STATUS_EMPTY;
+            break;
+        case OP_SIZE:
+            break;
+        case OP_SNAPSHOT:
+            if (table->snapshotPrefix)
+                response->status = startSnapshot(table, (int)request->heapId);
+            else
+                response->status = STATUS_BAD_OPCODE;
+            break;
+        default:
+            response->status = STATUS_BAD_OPCODE;
+    }
+    response->size = heap->size;
+}
+
+/**
+ * Executes the complete request frames in a buffer and appends the responses to an output buffer.
+ * Frames hold a uint32 length in host byte order followed by a ProtocolRequest; longer frames
+ * are accepted and their extra bytes ignored, so the request can grow compatibly.
+ * The output buffer is never written here: processing stops once it has no room for another
+ * response, and the caller flushes it and calls again with the rest of the data.
+ * @param table The heaps to operate on.
+ * @param data The received bytes.
+ * @param length Number of received bytes.
+ * @param out Where the responses are collected.
+ * @return Number of bytes consumed, which excludes a trailing partial frame and frames left
+ *         for lack of output space, or SIZE_MAX if a frame is longer than PROTOCOL_MAX_FRAME.
+ */
+size_t processRequests(HeapTable *table, const char *data, size_t length, OutputBuffer *out)
+{
+    ProtocolRequest request;
+    ProtocolResponse response;
+    uint32_t frameLength;
+    uint32_t responseLength = sizeof(response);
+    size_t consumed = 0;
+
+    while (length - consumed >= sizeof(frameLength)
+           && sizeof(out->data) - out->length >= sizeof(responseLength) + sizeof(response))
+    {
+        memcpy(&frameLength, data + consumed, sizeof(frameLength));
+        if (frameLength > PROTOCOL_MAX_FRAME)
+            return SIZE_MAX;
+        if (length - consumed - sizeof(frameLength) < frameLength)
+            break;
+
+        if (frameLength < sizeof(request))
+        {
+            memset(&response, 0, sizeof(response));
+            response.status = STATUS_BAD_REQUEST;
+        }
+        else
+        {
+            memcpy(&request, data + consumed + sizeof(frameLength), sizeof(request));
+            executeRequest(table, &request, &response);
+        }
+        writeOutput(out, &responseLength, sizeof(responseLength));
+        writeOutput(out, &response, sizeof(response));
+        consumed += sizeof(frameLength) + frameLength;
+    }
+    return consumed;
+}
+
+/**
+ * Fills a heap table with every array of an input file, built in parallel.
+ * @param table The heap table to initialize.
+ * @param fileName Name of the file containing heap data, or NULL to start with no heaps.
+ * @param d The degree of the heaps.
+ */
+void loadHeapTable(HeapTable *table, const char *fileName, int d)
+{
+    table->heaps = NULL;
+    table->numHeaps = 0;
+    table->capacity = 0;
+    table->tracePrefix = NULL;
+    table->logSyncMs = -1;
+    table->snapshotPrefix = NULL;
+    table->snapshotKeep = SNAPSHOT_KEEP;
+    memset(&table->snapshot, 0, sizeof(table->snapshot));
+    if (fileName)
+    {
+        table->heaps = readHeapsFromFile(&table->numHeaps, fileName, d);
+        table->capacity = table->numHeaps;
+    }
+}
+
+/**
+ * Starts recording the operations of one heap of a table to the file tracePrefix.N,
+ * as a write-ahead log if the table has logs.
+ * @param table The heap table, with a trace prefix.
+ * @param id Position of the heap.
+ */
+void startTableTrace(HeapTable *table, int id)
+{
+    char traceName[MAX_FILENAME_LENGTH + 16];
+    if (snprintf(traceName, sizeof(traceName), "%s.%d", table->tracePrefix, id) >= (int)sizeof(traceName))
+    {
+        fprintf(stderr, "Error: trace file name is too long\n");
+        exit(EXIT_FAILURE);
+    }
+    if (table->logSyncMs >= 0)
+        startHeapLog(&table->heaps[id], traceName, table->logSyncMs);
+    else
+        startTrace(&table->heaps[id], traceName);
+}
+
+/**
+ * Records the operations of every heap of a table, including the heaps created later,
+ * with one trace file per heap: heap N goes to PREFIX.N.
+ * @param table The heap table.
+ * @param prefix Start of the trace file names.
+ */
+void traceHeapTable(HeapTable *table, const char *prefix)
+{
+    int i;
+    table->tracePrefix = prefix;
+    for (i = 0; i < table->numHeaps; i++)
+        startTableTrace(table, i);
+}
+
+/**
+ * Makes every heap of a table durable, including the heaps created later, with one write-ahead
+ * log per heap: heap N goes to PREFIX.N. Heaps whose log exists are first recovered from it,
+ * replacing the heap loaded from the input file. Recovery stops at the first missing log; a
+ * later log is an error, since the heap it belongs to would start over and overwrite it.
+ * @param table The heap table.
+ * @param prefix Start of the log file names.
+ * @param syncMs Milliseconds a record may wait for its sync.
+ */
+void logHeapTable(HeapTable *table, const char *prefix, long syncMs)
+{
+    char logName[MAX_FILENAME_LENGTH + 16];
+    Heap recovered;
+    int id, later;
+
+    for (id = 0; snprintf(logName, sizeof(logName), "%s.%d", prefix, id) < (int)sizeof(logName)
+                 && recoverHeapLog(&recovered, logName); id++)
+    {
+        if (id == table->numHeaps)
+            createTableHeap(table, recovered.d);
+        freeHeap(&table->heaps[id]);
+        table->heaps[id] = recovered;
+    }
+    later = findLaterLog(prefix, id);
+    if (later >= 0)
+    {
+        fprintf(stderr, "Error: %s.%d is missing but %s.%d exists, restore it or move the later logs away\n",
+                prefix, id, prefix, later);
+        exit(EXIT_FAILURE);
+    }
+    table->tracePrefix = prefix;
+    table->logSyncMs = syncMs;
+    for (id = 0; id < table->numHeaps; id++)
+        startTableTrace(table, id);
+}
+
+/**
+ * Syncs the write-ahead logs of a table whose records have waited long enough, see commitHeapLog(),
+ * and checkpoints the logs that grew too large, see trimHeapLog().
+ * @param table The heap table.
+ */
+void commitHeapTable(HeapTable *table)
+{
+    int i;
+    for (i = 0; i < table->numHeaps; i++)
+        if (table->heaps[i].log)
+        {
+            commitHeapLog(&table->heaps[i], 0);
+            trimHeapLog(&table->heaps[i]);
+        }
+}
+
+/**
+ * Body of the child process of a background snapshot: writes the heap as it was at the fork
+ * to fileName.tmp, syncs it, shifts the older snapshots up from fileName.1, dropping the one
+ * past keep, hard-links the current one as fileName.1 and renames the new one over fileName.
+ * fileName thus always exists, whenever a crash happens. The child ends with _exit() and never calls
+ * exit(), which would write the parent's buffered output, trace records among it, a second time.
+ * @param heap The heap to save.
+ * @param fileName Name of the snapshot.
+ * @param keep Number of older snapshots to keep.
+ * @param progress Where the keys written so far are published to the parent.
+ */
+void writeSnapshot(const Heap *heap, const char *fileName, int keep, SnapshotProgress *progress)
+{
+    char tempName[MAX_FILENAME_LENGTH + 32], olderName[MAX_FILENAME_LENGTH + 32], newerName[MAX_FILENAME_LENGTH + 32];
+    FILE *file;
+    int failed;
+
+    closefrom(STDERR_FILENO + 1); /*a client sees its connection end as soon as the parent closes it*/
+    snprintf(tempName, sizeof(tempName), "%s.tmp", fileName);
+    file = fopen(tempName, "wb");
+    failed = !file || writeHeapFile(heap, file, progress) != 0 || fflush(file) != 0 || fdatasync(fileno(file)) != 0;
+    if (file && fclose(file) != 0)
+        failed = 1;
+    for (; !failed && keep > 1; keep--)
+    {
+        snprintf(olderName, sizeof(olderName), "%s.%d", fileName, keep);
+        snprintf(newerName, sizeof(newerName), "%s.%d", fileName, keep - 1);
+        failed = rename(newerName, olderName) != 0 && errno != ENOENT;
+    }
+    if (!failed && keep == 1)
+    {
+        /*a link, not a rename, so that fileName is never missing*/
+        snprintf(olderName, sizeof(olderName), "%s.1", fileName);
+        failed = (unlink(olderName) != 0 && errno != ENOENT) || (link(fileName, olderName) != 0 && errno != ENOENT);
+    }
+    if (failed || rename(tempName, fileName) != 0 || syncParentDirectory(fileName) != 0)
+    {
+        perror("Error writing snapshot");
+        _exit(EXIT_FAILURE);
+    }
+    _exit(EXIT_SUCCESS);
+}
+
+/**
+ * Starts saving one heap of a table to the heap file snapshotPrefix.N in the background.
+ * A forked child writes the heap while this process goes on serving requests. The two share
+ * the heap copy-on-write, so the snapshot holds the keys of the moment it was started and only
+ * the pages changed meanwhile get copied; the fork itself is the only pause. One snapshot runs at a time.
+ * @param table The heap table, with a snapshot prefix.
+ * @param id Position of the heap.
+ * @return STATUS_OK once the snapshot runs, STATUS_BUSY if the last one is still running,
+ *         STATUS_FAILED if it could not be started.
+ */
+ProtocolStatus startSnapshot(HeapTable *table, int id)
+{
+    BackgroundSnapshot *snapshot = &table->snapshot;
+    char fileName[MAX_FILENAME_LENGTH + 16];
+    pid_t pid;
+
+    if (pollSnapshot(table, 0) == SNAPSHOT_RUNNING)
+        return STATUS_BUSY;
+    snapshot->heapId = id;
+    snapshot->state = SNAPSHOT_FAILED;
+    if (snprintf(fileName, sizeof(fileName), "%s.%d", table->snapshotPrefix, id) >= (int)sizeof(fileName))
+        return STATUS_FAILED;
+    if (!snapshot->progress)
+    {
+        snapshot->progress = mmap(NULL, sizeof(SnapshotProgress), PROT_READ | PROT_WRITE,
+                                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (snapshot->progress == MAP_FAILED)
+        {
+            snapshot->progress = NULL;
+            return STATUS_FAILED;
+        }
+    }
+    atomic_store(&snapshot->progress->written, 0);
+    snapshot->progress->total = table->heaps[id].size;
+
+    pid = fork();
+    if (pid == 0)
+        writeSnapshot(&table->heaps[id], fileName, table->snapshotKeep, snapshot->progress);
+    if (pid < 0)
+        return STATUS_FAILED;
+    snapshot->pid = pid;
+    snapshot->state = SNAPSHOT_RUNNING;
+    return STATUS_OK;
+}
+
+/**
+ * Collects the child of a running background snapshot once it has ended.
+ * @param table The heap table.
+ * @param wait 1 to wait for a running snapshot to end, 0 to return at once.
+ * @return The state of the last snapshot.
+ */
+SnapshotState pollSnapshot(HeapTable *table, int wait)
+{
+    BackgroundSnapshot *snapshot = &table->snapshot;
+    pid_t pid;
+    int status;
+
+    if (snapshot->state != SNAPSHOT_RUNNING)
+        return snapshot->state;
+    do
+        pid = waitpid(snapshot->pid, &status, wait ? 0 : WNOHANG);
+    while (pid < 0 && errno == EINTR);
+    if (pid == 0)
+        return SNAPSHOT_RUNNING;
+    snapshot->state = pid == snapshot->pid && WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS
+                      ? SNAPSHOT_DONE : SNAPSHOT_FAILED;
+    snapshot->pid = 0;
+    return snapshot->state;
+}
+
+/**
+ * Releases every heap of a heap table, after a running background snapshot has finished.
+ * @param table The heap table.
+ */
+void freeHeapTable(HeapTable *table)
+{
+    int i;
+    pollSnapshot(table, 1);
+    if (table->snapshot.progress)
+        munmap(table->snapshot.progress, sizeof(SnapshotProgress));
+    for (i = 0; i < table->numHeaps; i++)
+        freeHeap(&table->heaps[i]);
+    free(table->heaps);
+    table->heaps = NULL;
+    table->numHeaps = 0;
+    table->capacity = 0;
+}
+
+/**
+ * Serves the binary protocol on standard input and output, for driving the heaps from another process.
+ * Every read may carry many pipelined requests; their responses are written together.
+ * Usage: pipe [-d D] [-t PREFIX] [-b PREFIX [-k KEEP]] [FILE]
+ * The heaps are the arrays of FILE, built with degree D (default 2), plus any created by requests.
+ * With -t the operations on heap N are recorded to the trace file PREFIX.N. With -b, snapshot
+ * requests save heap N in the background to PREFIX.N, keeping KEEP older ones (default SNAPSHOT_KEEP).
+ * @param argc Number of arguments, argv[0] being "pipe".
+ * @param argv The arguments.
+ * @return The exit status of the program.
+ */
+int runPipe(int argc, const char *argv[])
+{
+    HeapTable table;
+    OutputBuffer *out;
+    char *buffer;
+    const char *fileName = NULL, *tracePrefix = NULL, *snapshotPrefix = NULL;
+    size_t length = 0, offset, consumed;
+    ssize_t count;
+    int keep = SNAPSHOT_KEEP;
+    int d = 2;
+    int i;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-d") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            d = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+            tracePrefix = argv[++i];
+        else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+            snapshotPrefix = argv[++i];
+        else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc && atoi(argv[i + 1]) >= 0)
+            keep = atoi(argv[++i]);
+        else if (argv[i][0] != '-' && !fileName)
+            fileName = argv[i];
+        else
+            break;
+    }
+    if (i < argc)
+    {
+        fprintf(stderr, "Usage: pipe [-d D] [-t PREFIX] [-b PREFIX [-k KEEP]] [FILE]\n");
+        return EXIT_FAILURE;
+    }
+
+    loadHeapTable(&table, fileName, d);
+    if (tracePrefix)
+        traceHeapTable(&table, tracePrefix);
+    table.snapshotPrefix = snapshotPrefix;
+    table.snapshotKeep = keep;
+    buffer = malloc(PROTOCOL_BUFFER_SIZE);
+    out = malloc(sizeof(OutputBuffer));
+    if (!buffer || !out)
+    {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    out->length = 0;
+    out->fd = STDOUT_FILENO;
+
+    while ((count = read(STDIN_FILENO, buffer + length, PROTOCOL_BUFFER_SIZE - length)) > 0)
+    {
+        length += (size_t)count;
+        offset = 0;
+        do
+        {
+            consumed = processRequests(&table, buffer + offset, length - offset, out);
+            if (consumed == SIZE_MAX)
+            {
+                fprintf(stderr, "Error: request frame too long\n");
+                exit(EXIT_FAILURE);
+            }
+            offset += consumed;
+            flushOutput(out);
+        } while (consumed > 0);
+        length -= offset;
+        memmove(buffer, buffer + offset, length);
+    }
+    if (count < 0)
+    {
+        perror("Error reading requests");
+        exit(EXIT_FAILURE);
+    }
+
+    free(buffer);
+    free(out);
+    freeHeapTable(&table);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Advances a xorshift64* generator, used for keys in load generators and benchmarks.
+ * @param state The generator state, never 0.
+ * @return The next pseudo-random number.
+ */
+uint64_t nextRandom(uint64_t *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ULL;
+}
+
+/* Cleared by SIGINT or SIGTERM to stop the socket server*/
+static volatile sig_atomic_t serverRunning = 1;
+
+/**
+ * Signal handler that asks the socket server to stop.
+ * @param signalNumber The signal received.
+ */
+void stopServer(int signalNumber)
+{
+    (void)signalNumber;
+    serverRunning = 0;
+}
+
+/**
+ * Sends pending responses and executes buffered requests of one connection, alternating
+ * until the input runs out or the socket cannot take more output.
+ * @param table The heaps to operate on.
+ * @param connection The connection.
+ * @return 1 if output is still pending, 0 if everything was sent, -1 if the connection must be closed.
+ */
+int serveConnection(HeapTable *table, Connection *connection)
+{
+    size_t consumed, offset = 0;
+    ssize_t count;
+
+    while (1)
+    {
+        while (connection->outSent < connection->out.length)
+        {
+            count = write(connection->fd, connection->out.data + connection->outSent,
+                          connection->out.length - connection->outSent);
+            if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                /*stop reading until the client takes its responses*/
+                memmove(connection->in, connection->in + offset, connection->inLength - offset);
+                connection->inLength -= offset;
+                return 1;
+            }
+            if (count < 0)
+                return -1;
+            connection->outSent += (size_t)count;
+        }
+        connection->out.length = 0;
+        connection->outSent = 0;
+
+        consumed = processRequests(table, connection->in + offset, connection->inLength - offset, &connection->out);
+        if (consumed == SIZE_MAX)
+            return -1;
+        if (consumed == 0)
+            break;
+        offset += consumed;
+    }
+
+    memmove(connection->in, connection->in + offset, connection->inLength - offset);
+    connection->inLength -= offset;
+    return 0;
+}
+
+/**
+ * Serves the binary protocol to local processes on a Unix domain socket.
+ * One thread runs an epoll loop over all clients; every read may carry many pipelined requests
+ * and their responses go out in one write. All clients share the same heaps.
+ * Usage: serve [-d D] [-t PREFIX | -w PREFIX [-f SYNC_MS]] [-b PREFIX [-k KEEP]] SOCKET [FILE]
+ * With -t the operations on heap N are recorded to the trace file PREFIX.N. With -w they go to
+ * the write-ahead log PREFIX.N instead, synced every SYNC_MS milliseconds (default WAL_SYNC_MS),
+ * and heaps with a log are recovered from it at start. With -b, snapshot requests save heap N
+ * in the background to PREFIX.N, keeping KEEP older ones (default SNAPSHOT_KEEP).
+ * @param argc Number of arguments, argv[0] being "serve".
+ * @param argv The arguments.
+ * @return The exit status of the program.
+ */
+int runServer(int argc, const char *argv[])
+{
+    HeapTable table;
+    struct sockaddr_un address;
+    struct epoll_event event, events[MAX_EVENTS];
+    Connection *connection;
+    const char *socketName = NULL, *fileName = NULL, *tracePrefix = NULL, *logPrefix = NULL, *snapshotPrefix = NULL;
+    ssize_t count;
+    int listener, epoll, client;
+    int numEvents, pending;
+    long syncMs = WAL_SYNC_MS;
+    int keep = SNAPSHOT_KEEP;
+    int d = 2;
+    int i;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-d") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            d = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+            tracePrefix = argv[++i];
+        else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc)
+            logPrefix = argv[++i];
+        else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc && atol(argv[i + 1]) >= 0)
+            syncMs = atol(argv[++i]);
+        else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+            snapshotPrefix = argv[++i];
+        else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc && atoi(argv[i + 1]) >= 0)
+            keep = atoi(argv[++i]);
+        else if (argv[i][0] != '-' && !socketName)
+            socketName = argv[i];
+        else if (argv[i][0] != '-' && !fileName)
+            fileName = argv[i];
+        else
+            break;
+    }
+    if (i < argc || !socketName || strlen(socketName) >= sizeof(address.sun_path) || (tracePrefix && logPrefix))
+    {
+        fprintf(stderr, "Usage: serve [-d D] [-t PREFIX | -w PREFIX [-f SYNC_MS]] [-b PREFIX [-k KEEP]] SOCKET [FILE]\n");
+        return EXIT_FAILURE;
+    }
+
+    loadHeapTable(&table, fileName, d);
+    if (tracePrefix)
+        traceHeapTable(&table, tracePrefix);
+    if (logPrefix)
+        logHeapTable(&table, logPrefix, syncMs);
+    table.snapshotPrefix = snapshotPrefix;
+    table.snapshotKeep = keep;
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socketName);
+    unlink(socketName);
+    listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (listener < 0 || bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0
+        || listen(listener, SOMAXCONN) != 0)
+    {
+        perror("Error creating socket");
+        exit(EXIT_FAILURE);
+    }
+
+    epoll = epoll_create1(0);
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    if (epoll < 0 || epoll_ctl(epoll, EPOLL_CTL_ADD, listener, &event) != 0)
+    {
+        perror("Error creating epoll instance");
+        exit(EXIT_FAILURE);
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, stopServer);
+    signal(SIGTERM, stopServer);
+    printf("Serving %d heaps on %s\n", table.numHeaps, socketName);
+    fflush(stdout);
+
+    while (serverRunning)
+    {
+        /*wake up in time to sync the logs of a quiet server*/
+        numEvents = epoll_wait(epoll, events, MAX_EVENTS, logPrefix && syncMs > 0 ? (int)syncMs : -1);
+        if (numEvents < 0 && errno == EINTR)
+            continue;
+        if (numEvents < 0)
+        {
+            perror("Error waiting for events");
+            exit(EXIT_FAILURE);
+        }
+
+        for (i = 0; i < numEvents; i++)
+        {
+            connection = events[i].data.ptr;
+
+            /*accept every waiting client*/
+            if (!connection)
+            {
+                while ((client = accept4(listener, NULL, NULL, SOCK_NONBLOCK)) >= 0)
+                {
+                    connection = calloc(1, sizeof(Connection));
+                    if (!connection)
+                    {
+                        fprintf(stderr, "Error: out of memory\n");
+                        exit(EXIT_FAILURE);
+                    }
+                    connection->fd = client;
+                    connection->out.fd = client;
+                    event.events = EPOLLIN;
+                    event.data.ptr = connection;
+                    epoll_ctl(epoll, EPOLL_CTL_ADD, client, &event);
+                }
+                continue;
+            }
+
+            /*read whatever fits, then serve it*/
+            pending = 0;
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+            {
+                count = read(connection->fd, connection->in + connection->inLength,
+                             sizeof(connection->in) - connection->inLength);
+                if (count == 0 || (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+                    pending = -1;
+                else if (count > 0)
+                    connection->inLength += (size_t)count;
+            }
+            if (pending == 0)
+                pending = serveConnection(&table, connection);
+
+            if (pending < 0)
+            {
+                epoll_ctl(epoll, EPOLL_CTL_DEL, connection->fd, NULL);
+                close(connection->fd);
+                free(connection);
+                continue;
+            }
+            event.events = pending ? EPOLLOUT : EPOLLIN;
+            event.data.ptr = connection;
+            epoll_ctl(epoll, EPOLL_CTL_MOD, connection->fd, &event);
+        }
+        if (logPrefix)
+            commitHeapTable(&table);
+        pollSnapshot(&table, 0); /*collect a finished snapshot child*/
+    }
+
+    printf("Stopping server\n");
+    close(epoll);
+    close(listener);
+    unlink(socketName);
+    freeHeapTable(&table);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Reads exactly length bytes from a descriptor.
+ * @param fd The descriptor to read from.
+ * @param data Where to store the bytes.
+ * @param length Number of bytes to read.
+ */
+void readFully(int fd, void *data, size_t length)
+{
+    char *bytes = data;
+    ssize_t count;
+
+    while (length > 0)
+    {
+        count = read(fd, bytes, length);
+        if (count <= 0)
+        {
+            fprintf(stderr, "Error: connection closed by server\n");
+            exit(EXIT_FAILURE);
+        }
+        bytes += count;
+        length -= (size_t)count;
+    }
+}
+
+/**
+ * Thread body of the load generator: one connection that creates its own heap and sends
+ * alternating inserts and extracts in pipelined windows, timing every request from the
+ * write of its window to the arrival of its response.
+ * @param arg Pointer to the LoadClient of the thread.
+ * @return Always NULL.
+ */
+void *loadClientThread(void *arg)
+{
+    LoadClient *client = arg;
+    struct sockaddr_un address;
+    uint32_t frameLength = sizeof(ProtocolRequest);
+    uint32_t heapId;
+    char *requests, *responses;
+    ProtocolRequest request;
+    ProtocolResponse response;
+    size_t frameSize = sizeof(frameLength) + sizeof(ProtocolRequest);
+    size_t responseSize = sizeof(uint32_t) + sizeof(ProtocolResponse);
+    uint64_t sent;
+    int fd, done, window, j;
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, client->socketName);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0)
+    {
+        perror("Error connecting to server");
+        exit(EXIT_FAILURE);
+    }
+
+    requests = malloc((size_t)client->pipeline * frameSize);
+    responses = malloc((size_t)client->pipeline * responseSize);
+    if (!requests || !responses)
+    {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /*every connection works on a heap of its own*/
+    memset(&request, 0, sizeof(request));
+    request.opcode = OP_CREATE;
+    request.key = client->d;
+    memcpy(requests, &frameLength, sizeof(frameLength));
+    memcpy(requests + sizeof(frameLength), &request, sizeof(request));
+    writeAll(fd, requests, frameSize);
+    readFully(fd, responses, responseSize);
+    memcpy(&response, responses + sizeof(uint32_t), sizeof(response));
+    heapId = response.heapId;
+
+    for (done = 0; done < client->requests; done += window)
+    {
+        window = client->requests - done < client->pipeline ? client->requests - done : client->pipeline;
+        for (j = 0; j < window; j++)
+        {
+            memset(&request, 0, sizeof(request));
+            request.heapId = heapId;
+            request.opcode = (done + j) % 2 == 0 ? OP_INSERT : OP_EXTRACT_MAX;
+            request.key = (int32_t)(nextRandom(&client->seed) >> 33);
+            memcpy(requests + (size_t)j * frameSize, &frameLength, sizeof(frameLength));
+            memcpy(requests + (size_t)j * frameSize + sizeof(frameLength), &request, sizeof(request));
+        }
+
+        sent = nowNanoseconds();
+        writeAll(fd, requests, (size_t)window * frameSize);
+        for (j = 0; j < window; j++)
+        {
+            readFully(fd, responses, responseSize);
+            client->latencies[done + j] = nowNanoseconds() - sent;
+            memcpy(&response, responses + sizeof(uint32_t), sizeof(response));
+            if (response.status != STATUS_OK)
+                client->errors++;
+        }
+    }
+
+    close(fd);
+    free(requests);
+    free(responses);
+    return NULL;
+}
+
+/**
+ * Orders two uint64_t values, for qsort().
+ * @param a Pointer to the first value.
+ * @param b Pointer to the second value.
+ * @return Negative, zero or positive as a is less than, equal to or greater than b.
+ */
+int compareUint64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Measures a running socket server: several connections send pipelined inserts and extracts
+ * and the throughput and latency percentiles over all requests are reported.
+ * Usage: loadgen [-c CONNECTIONS] [-n REQUESTS] [-p PIPELINE] [-d D] SOCKET
+ * REQUESTS is per connection (default 100000), PIPELINE is the number of requests per write (default 64).
+ * @param argc Number of arguments, argv[0] being "loadgen".
+ * @param argv The arguments.
+ * @return The exit status of the program.
+ */
+int runLoadGenerator(int argc, const char *argv[])
+{
+    LoadClient *clients;
+    pthread_t *threads;
+    uint64_t *latencies;
+    const char *socketName = NULL;
+    uint64_t start, elapsed;
+    long total, errors = 0;
+    int connections = 4, requests = 100000, pipeline = 64, d = 2;
+    int i;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-c") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            connections = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            requests = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            pipeline = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            d = atoi(argv[++i]);
+        else if (argv[i][0] != '-' && !socketName)
+            socketName = argv[i];
+        else
+            break;
+    }
+    if (i < argc || !socketName || strlen(socketName) >= sizeof(((struct sockaddr_un *)0)->sun_path))
+    {
+        fprintf(stderr, "Usage: loadgen [-c CONNECTIONS] [-n REQUESTS] [-p PIPELINE] [-d D] SOCKET\n");
+        return EXIT_FAILURE;
+    }
+
+    total = (long)connections * requests;
+    clients = calloc((size_t)connections, sizeof(LoadClient));
+    threads = malloc((size_t)connections * sizeof(pthread_t));
+    latencies = malloc((size_t)total * sizeof(uint64_t));
+    if (!clients || !threads || !latencies)
+    {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    start = nowNanoseconds();
+    for (i = 0; i < connections; i++)
+    {
+        clients[i].socketName = socketName;
+        clients[i].requests = requests;
+        clients[i].pipeline = pipeline;
+        clients[i].d = d;
+        clients[i].seed = 0x9E3779B97F4A7C15ULL * (uint64_t)(i + 1);
+        clients[i].latencies = latencies + (size_t)i * (size_t)requests;
+        if (pthread_create(&threads[i], NULL, loadClientThread, &clients[i]) != 0)
+        {
+            fprintf(stderr, "Error: cannot create thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (i = 0; i < connections; i++)
+    {
+        pthread_join(threads[i], NULL);
+        errors += clients[i].errors;
+    }
+    elapsed = nowNanoseconds() - start;
+
+    qsort(latencies, (size_t)total, sizeof(uint64_t), compareUint64);
+    printf("%ld requests over %d connections, pipeline %d: %.3f s, %.0f ops/s, %ld errors\n",
+           total, connections, pipeline, elapsed / 1e9, total * 1e9 / (double)elapsed, errors);
+    printf("latency us: p50 %.1f  p99 %.1f  p999 %.1f  max %.1f\n",
+           latencies[total / 2] / 1e3, latencies[total * 99 / 100] / 1e3,
+           latencies[total * 999 / 1000] / 1e3, latencies[total - 1] / 1e3);
+
+    free(clients);
+    free(threads);
+    free(latencies);
+    return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/**
+ * Creates a heap shared behind one mutex, the baseline for the concurrent heaps.
+ * @param d The degree of the heap.
+ * @param numThreads Number of threads that will use the heap, unused.
+ * @return The new LockedHeap.
+ */
+void *createLockedHeap(int d, int numThreads)
+{
+    LockedHeap *queue = malloc(sizeof(LockedHeap));
+    (void)numThreads;
+    if (!queue)
+    {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    initHeap(&queue->heap, INITIAL_CAPACITY, d);
+    pthread_mutex_init(&queue->lock, NULL);
+    return queue;
+}
+
+/**
+ * Inserts a key into a LockedHeap.
+ * @param queue The LockedHeap.
+ * @param thread Index of the calling thread, unused.
+ * @param key The key to insert.
+ */
+void lockedInsert(void *queue, int thread, int key)
+{
+    LockedHeap *locked = queue;
+    (void)thread;
+    pthread_mutex_lock(&locked->lock);
+    insert(&locked->heap, key);
+    pthread_mutex_unlock(&locked->lock);
+}
+
+/**
+ * Extracts the maximum of a LockedHeap.
+ * @param queue The LockedHeap.
+ * @param thread Index of the calling thread, unused.
+ * @param key Where to store the extracted key.
+ * @return 1 if a key was extracted, 0 if the heap was empty.
+ */
+int lockedExtract(void *queue, int thread, int *key)
+{
+    LockedHeap *locked = queue;
+    int found;
+    (void)thread;
+    pthread_mutex_lock(&locked->lock);
+    found = locked->heap.size > 0;
+    if (found)
+        *key = heapExtractMax(&locked->heap);
+    pthread_mutex_unlock(&locked->lock);
+    return found;
+}
+
+/**
+ * Releases a LockedHeap.
+ * @param queue The LockedHeap.
+ */
+void destroyLockedHeap(void *queue)
+{
+    LockedHeap *locked = queue;
+    pthread_mutex_destroy(&locked->lock);
+    freeHeap(&locked->heap);
+    free(locked);
+}
+
+/**
+ * Creates a heap shared through flat combining.
+ * @param d The degree of the heap.
+ * @param numThreads Number of threads that will use the heap, each with its own index below this.
+ * @return The new CombiningHeap.
+ */
+void *createCombiningHeap(int d, int numThreads)
+{
+    CombiningHeap *queue;
+    int i;
+
+    if (numThreads > MAX_THREADS)
+    {
+        fprintf(stderr, "Error: at most %d threads are supported\n", MAX_THREADS);
+        exit(EXIT_FAILURE);
+    }
+    queue = aligned_alloc(CACHE_LINE, sizeof(CombiningHeap));
+    if (!queue)
+    {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    initHeap(&queue->heap, INITIAL_CAPACITY, d);
+    pthread_mutex_init(&queue->lock, NULL);
+    for (i = 0; i < MAX_THREADS; i++)
+        atomic_init(&queue->slots[i].state, FC_IDLE);
+    queue->numThreads = numThreads;
+    return queue;
+}
+
+/**
+ * Applies every published request to the heap, called with the lock held.
+ * All inserts of the pass go in with one insertMany() and all extracts are served by one
+ * extractTop(), so the heap is walked once per batch instead of once per request.
+ * @param queue The CombiningHeap.
+ */
+void combine(CombiningHeap *queue)
+{
+    CombiningSlot *slot;
+    int numKeys = 0, numExtractors = 0, found, i;
+
+    for (i = 0; i < queue->numThreads; i++)
+    {
+        slot = &queue->slots[i];
+        switch (atomic_load_explicit(&slot->state, memory_order_acquire))
+        {
+            case FC_INSERT:
+                queue->keys[numKeys++] = slot->key;
+                atomic_store_explicit(&slot->state, FC_DONE, memory_order_release);
+                break;
+            case FC_EXTRACT:
+                queue->extractors[numExtractors++] = i;
+                break;
+        }
+    }
+
+    insertMany(&queue->heap, queue->keys, numKeys);
+    found = extractTop(&queue->heap, queue->keys, numExtractors);
+    for (i = 0; i < numExtractors; i++)
+    {
+        slot = &queue->slots[queue->extractors[i]];
+        slot->found = i < found;
+        if (slot->found)
+            slot->key = queue->keys[i];
+        atomic_store_explicit(&slot->state, FC_DONE, memory_order_release);
+    }
+}
+
+/**
+ * Publishes a request and waits until some combiner, possibly this thread, applied it.
+ * @param queue The CombiningHeap.
+ * @param thread Index of the calling thread.
+ * @param op FC_INSERT or FC_EXTRACT.
+ * @param key The key to insert, or where to store the extracted key.
+ * @return 1 if the request was an insert or found a key to extract, 0 otherwise.
+ */
+int combiningRequest(CombiningHeap *queue, int thread, CombiningState op, int *key)
+{
+    CombiningSlot *slot = &queue->slots[thread];
+    int found;
+
+    slot->key = *key;
+    atomic_store_explicit(&slot->state, op, memory_order_release);
+
+    while (atomic_load_explicit(&slot->state, memory_order_acquire) != FC_DONE)
+    {
+        if (pthread_mutex_trylock(&queue->lock) == 0)
+        {
+            if (atomic_load_explicit(&slot->state, memory_order_acquire) != FC_DONE)
+                combine(queue);
+            pthread_mutex_unlock(&queue->lock);
+        }
+        else
+            sched_yield();
+    }
+
+    found = op == FC_INSERT || slot->found;
+    if (op == FC_EXTRACT && found)
+        *key = slot->key;
+    atomic_store_explicit(&slot->state, FC_IDLE, memory_order_relaxed);
+    return found;
+}
+
+/**
+ * Inserts a key into a CombiningHeap.
+ * @param queue The CombiningHeap.
+ * @param thread Index of the calling thread.
+ * @param key The key to insert.
+ */
+void combiningInsert(void *queue, int thread, int key)
+{
+    combiningRequest(queue, thread, FC_INSERT, &key);
+}
+
+/**
+ * Extracts the maximum of a CombiningHeap.
+ * @param queue The CombiningHeap.
+ * @param thread Index of the calling thread.
+ * @param key Where to store the extracted key.
+ * @return 1 if a key was extracted, 0 if the heap was empty.
+ */
+int combiningExtract(void *queue, int thread, int *key)
+{
+    return combiningRequest(queue, thread, FC_EXTRACT, key);
+}
+
+/**
+ * Releases a CombiningHeap.
+ * @param queue The CombiningHeap.
+ */
+void destroyCombiningHeap(void *queue)
+{
+    CombiningHeap *combining = queue;
+    pthread_mutex_destroy(&combining->lock);
+    freeHeap(&combining->heap);
+    free(combining);
+}
+
+/**
+ * Creates a MultiQueue with QUEUES_PER_THREAD heaps per thread.
+ * @param d The degree of the heaps.
+ * @param numThreads Number of threads that will use the queue, each with its own index below this.
+ * @return The new MultiQueue.
+ */
+void *createMultiQueue(int d, int numThreads)
+{
+    MultiQueue *queue;
+    int i;
+
+    if (numThreads > MAX_THREADS)
+    {
+        fprintf(stderr, "Error: at most %d threads are supported\n", MAX_THREADS);
+        exit(EXIT_FAILURE);
+    }
+    queue = aligned_alloc(CACHE_LINE, sizeof(MultiQueue));
+    if (queue)
+    {
+        queue->numQueues = QUEUES_PER_THREAD * numThreads;
+        queue->queues = aligned_alloc(CACHE_LINE, (size_t)queue->numQueues * sizeof(MultiQueueShard));
+    }
+    if (!queue || !queue->queues)
+    {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < queue->numQueues; i++)
+    {
+        atomic_init(&queue->queues[i].locked, 0);
+        atomic_init(&queue->queues[i].size, 0);
+        atomic_init(&queue->queues[i].top, 0);
+        initHeap(&queue->queues[i].heap, INITIAL_CAPACITY, d);
+    }
+    for (i = 0; i < MAX_THREADS; i++)
+        queue->threads[i].seed = 0x2545F4914F6CDD1DULL * (uint64_t)(i + 1);
+    return queue;
+}
+
+/**
+ * Tries to take the lock of one MultiQueue heap without waiting.
+ * @param shard The heap.
+ * @return 1 if the lock was taken, 0 if another thread holds it.
+ */
+int tryLockShard(MultiQueueShard *shard)
+{
+    int expected = 0;
+    return atomic_load_explicit(&shard->locked, memory_order_relaxed) == 0
+           && atomic_compare_exchange_strong_explicit(&shard->locked, &expected, 1,
+                                                      memory_order_acquire, memory_order_relaxed);
+}
+
+/**
+ * Publishes the new size and maximum of a MultiQueue heap and releases its lock.
+ * @param shard The heap.
+ */
+void unlockShard(MultiQueueShard *shard)
+{
+    atomic_store_explicit(&shard->size, shard->heap.size, memory_order_relaxed);
+    if (shard->heap.size > 0)
+        atomic_store_explicit(&shard->top, shard->heap.array[ROOT], memory_order_relaxed);
+    atomic_store_explicit(&shard->locked, 0, memory_order_release);
+}
+
+/**
+ * Inserts a key into a random heap of a MultiQueue, trying other heaps while the chosen one is locked.
+ * @param queue The MultiQueue.
+ * @param thread Index of the calling thread.
+ * @param key The key to insert.
+ */
+void multiQueueInsert(void *queue, int thread, int key)
+{
+    MultiQueue *multi = queue;
+    MultiQueueShard *shard;
+
+    do
+        shard = &multi->queues[nextRandom(&multi->threads[thread].seed) % (uint64_t)multi->numQueues];
+    while (!tryLockShard(shard));
+
+    insert(&shard->heap, key);
+    unlockShard(shard);
+}
+
+/**
+ * Extracts a key close to the maximum of a MultiQueue: of two random heaps, the one with the
+ * larger maximum is extracted from. When random probing keeps finding empty heaps, all heaps
+ * are scanned once before the queue is reported empty.
+ * @param queue The MultiQueue.
+ * @param thread Index of the calling thread.
+ * @param key Where to store the extracted key.
+ * @return 1 if a key was extracted, 0 if every heap was empty.
+ */
+int multiQueueExtract(void *queue, int thread, int *key)
+{
+    MultiQueue *multi = queue;
+    MultiQueueShard *first, *second, *best;
+    uint64_t random;
+    int emptyProbes = 0, i;
+
+    while (1)
+    {
+        random = nextRandom(&multi->threads[thread].seed);
+        first = &multi->queues[(random & 0xFFFFFFFF) % (uint64_t)multi->numQueues];
+        second = &multi->queues[(random >> 32) % (uint64_t)multi->numQueues];
+
+        if (atomic_load_explicit(&first->size, memory_order_relaxed) == 0)
+            best = second;
+        else if (atomic_load_explicit(&second->size, memory_order_relaxed) == 0)
+            best = first;
+        else
+            best = atomic_load_explicit(&first->top, memory_order_relaxed)
+                   >= atomic_load_explicit(&second->top, memory_order_relaxed) ? first : second;
+
+        if (atomic_load_explicit(&best->size, memory_order_relaxed) == 0)
+        {
+            if (++emptyProbes < multi->numQueues)
+                continue;
+
+            /*the queue looks empty, make sure with a full scan*/
+            for (i = 0; i < multi->numQueues; i++)
+            {
+                best = &multi->queues[i];
+                if (atomic_load_explicit(&best->size, memory_order_relaxed) == 0)
+                    continue;
+                while (!tryLockShard(best))
+                    sched_yield();
+                if (best->heap.size > 0)
+                {
+                    *key = heapExtractMax(&best->heap);
+                    unlockShard(best);
+                    return 1;
+                }
+                unlockShard(best);
+            }
+            return 0;
+        }
+
+        if (!tryLockShard(best))
+            continue;
+        if (best->heap.size > 0)
+        {
+            *key = heapExtractMax(&best->heap);
+            unlockShard(best);
+            return 1;
+        }
+        unlockShard(best);
+    }
+}
+
+/**
+ * Releases a MultiQueue.
+ * @param queue The MultiQueue.
+ */
+void destroyMultiQueue(void *queue)
+{
+    MultiQueue *multi = queue;
+    int i;
+    for (i = 0; i < multi->numQueues; i++)
+        freeHeap(&multi->queues[i].heap);
+    free(multi->queues);
+    free(multi);
+}
+
+/**
+ * Creates a heap with a lock per node.
+ * The nodes are allocated zeroed, which makes them empty and unlocked, and the pages are only
+ * touched as the heap grows.
+ * @param d The degree of the heap.
+ * @param numThreads Number of threads that will use the heap, unused.
+ * @return The new HuntHeap.
+ */
+void *createHuntHeap(int d, int numThreads)
+{
+    HuntHeap *queue = malloc(sizeof(HuntHeap));
+    (void)numThreads;
+    if (queue)
+        queue->nodes = calloc(HUNT_CAPACITY, sizeof(HuntNode));
+    if (!queue || !queue->nodes)
+    {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    pthread_mutex_init(&queue->sizeLock, NULL);
+    queue->size = 0;
+    queue->d = d;
+    return queue;
+}
+
+/**
+ * Waits a little for another thread to make progress. The first calls only spin, later
+ * ones sleep, so that a preempted lock holder gets the processor back: yielding is not
+ * enough for that when there are more threads than processors.
+ * @param spins Number of times the caller has waited so far, incremented.
+ */
+void backOff(int *spins)
+{
+    struct timespec pause = { 0, 1000 };
+    if (++*spins < HUNT_SPINS)
+        return;
+    nanosleep(&pause, NULL);
+}
+
+/**
+ * Takes the spin lock of a heap node.
+ * @param node The node.
+ */
+void lockNode(HuntNode *node)
+{
+    int expected = 0, spins = 0;
+    while (!atomic_compare_exchange_weak_explicit(&node->lock, &expected, 1,
+                                                  memory_order_acquire, memory_order_relaxed))
+    {
+        expected = 0;
+        backOff(&spins);
+    }
+}
+
+/**
+ * Releases the spin lock of a heap node.
+ * @param node The node.
+ */
+void unlockNode(HuntNode *node)
+{
+    atomic_store_explicit(&node->lock, 0, memory_order_release);
+}
+
+/**
+ * Swaps the keys and tags of two locked nodes.
+ * @param a The first node.
+ * @param b The second node.
+ */
+void swapNodes(HuntNode *a, HuntNode *b)
+{
+    swap(&a->key, &b->key);
+    swap(&a->tag, &b->tag);
+}
+
+/**
+ * Inserts a key into a HuntHeap. The key is placed at the bottom tagged with the thread,
+ * then moved up one parent/child pair at a time. A concurrent extract may move the key
+ * up for us (then it is followed) or take it away (then there is nothing left to do).
+ * @param queue The HuntHeap.
+ * @param thread Index of the calling thread.
+ * @param key The key to insert.
+ */
+void huntInsert(void *queue, int thread, int key)
+{
+    HuntHeap *hunt = queue;
+    HuntNode *nodes = hunt->nodes;
+    int i, up, old, done = 0, spins = 0;
+
+    pthread_mutex_lock(&hunt->sizeLock);
+    if (hunt->size == HUNT_CAPACITY)
+    {
+        fprintf(stderr, "Error: heap overflow\n");
+        exit(EXIT_FAILURE);
+    }
+    i = hunt->size++;
+    lockNode(&nodes[i]);
+    pthread_mutex_unlock(&hunt->sizeLock);
+    nodes[i].key = key;
+    nodes[i].tag = HUNT_OWNER(thread);
+    unlockNode(&nodes[i]);
+
+    while (i > ROOT && !done)
+    {
+        up = parent(i, hunt->d);
+        old = i;
+        lockNode(&nodes[up]);
+        lockNode(&nodes[old]);
+        if (nodes[up].tag == HUNT_AVAILABLE && nodes[old].tag == HUNT_OWNER(thread))
+        {
+            if (nodes[old].key > nodes[up].key)
+            {
+                swapNodes(&nodes[old], &nodes[up]);
+                i = up;
+            }
+            else
+            {
+                nodes[old].tag = HUNT_AVAILABLE;
+                done = 1;
+            }
+        }
+        else if (nodes[up].tag == HUNT_EMPTY)
+            done = 1;             /*an extract took our key*/
+        else if (nodes[old].tag != HUNT_OWNER(thread))
+            i = up;               /*an extract moved our key up*/
+        unlockNode(&nodes[old]);
+        unlockNode(&nodes[up]);
+        if (i == old && !done)
+            backOff(&spins);      /*the parent is still moving up for another thread*/
+    }
+
+    if (!done)
+    {
+        lockNode(&nodes[ROOT]);
+        if (nodes[ROOT].tag == HUNT_OWNER(thread))
+            nodes[ROOT].tag = HUNT_AVAILABLE;
+        unlockNode(&nodes[ROOT]);
+    }
+}
+
+/**
+ * Extracts the maximum of a HuntHeap. The bottom key replaces the root and is moved down
+ * holding only the current node and its children, so inserts keep working elsewhere.
+ * @param queue The HuntHeap.
+ * @param thread Index of the calling thread, unused.
+ * @param key Where to store the extracted key.
+ * @return 1 if a key was extracted, 0 if the heap was empty.
+ */
+int huntExtract(void *queue, int thread, int *key)
+{
+    HuntHeap *hunt = queue;
+    HuntNode *nodes = hunt->nodes;
+    int bottom, bottomKey, i, first, last, largest, j;
+    (void)thread;
+
+    pthread_mutex_lock(&hunt->sizeLock);
+    if (hunt->size == 0)
+    {
+        pthread_mutex_unlock(&hunt->sizeLock);
+        return 0;
+    }
+    bottom = --hunt->size;
+    lockNode(&nodes[bottom]);
+    pthread_mutex_unlock(&hunt->sizeLock);
+    bottomKey = nodes[bottom].key;
+    nodes[bottom].tag = HUNT_EMPTY;
+    unlockNode(&nodes[bottom]);
+
+    lockNode(&nodes[ROOT]);
+    if (nodes[ROOT].tag == HUNT_EMPTY)
+    {
+        /*the bottom key was the only one*/
+        unlockNode(&nodes[ROOT]);
+        *key = bottomKey;
+        return 1;
+    }
+    *key = nodes[ROOT].key;
+    nodes[ROOT].key = bottomKey;
+    nodes[ROOT].tag = HUNT_AVAILABLE;
+
+    i = ROOT;
+    while ((first = child(i, 1, hunt->d)) < HUNT_CAPACITY)
+    {
+        last = child(i, hunt->d, hunt->d);
+        if (last >= HUNT_CAPACITY)
+            last = HUNT_CAPACITY - 1;
+
+        /*children are locked left to right, after their parent*/
+        largest = -1;
+        for (j = first; j <= last; j++)
+        {
+            lockNode(&nodes[j]);
+            if (nodes[j].tag != HUNT_EMPTY && (largest < 0 || nodes[j].key > nodes[largest].key))
+                largest = j;
+        }
+        for (j = first; j <= last; j++)
+            if (j != largest)
+                unlockNode(&nodes[j]);
+
+        if (largest < 0)
+            break;
+        if (nodes[largest].key > nodes[i].key)
+        {
+            swapNodes(&nodes[largest], &nodes[i]);
+            unlockNode(&nodes[i]);
+            i = largest;
+        }
+        else
+        {
+            unlockNode(&nodes[largest]);
+            break;
+        }
+    }
+    unlockNode(&nodes[i]);
+    return 1;
+}
+
+/**
+ * Releases a HuntHeap.
+ * @param queue The HuntHeap.
+ */
+void destroyHuntHeap(void *queue)
+{
+    HuntHeap *hunt = queue;
+    pthread_mutex_destroy(&hunt->sizeLock);
+    free(hunt->nodes);
+    free(hunt);
+}
+
+/**
+ * Creates a work-stealing queue with one heap per thread.
+ * @param d The degree of the heaps.
+ * @param numThreads Number of threads that will use the queue.
+ * @return The new StealQueue.
+ */
+void *createStealQueue(int d, int numThreads)
+{
+    StealQueue *queue;
+    int i;
+
+    if (numThreads > MAX_THREADS)
+    {
+        fprintf(stderr, "Error: at most %d threads are supported\n", MAX_THREADS);
+        exit(EXIT_FAILURE);
+    }
+    queue = malloc(sizeof(StealQueue));
+    if (queue)
+    {
+        queue->numShards = numThreads;
+        queue->shards = aligned_alloc(CACHE_LINE, (size_t)numThreads * sizeof(StealShard));
+    }
+    if (!queue || !queue->shards)
+    {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    memset(queue->shards, 0, (size_t)numThreads * sizeof(StealShard));
+    for (i = 0; i < numThreads; i++)
+    {
+        atomic_init(&queue->shards[i].locked, 0);
+        atomic_init(&queue->shards[i].size, 0);
+        initHeap(&queue->shards[i].heap, INITIAL_CAPACITY, d);
+        queue->shards[i].seed = 0x2545F4914F6CDD1DULL * (uint64_t)(i + 1);
+    }
+    return queue;
+}
+
+/**
+ * Tries to take the lock of a thread's heap without waiting.
+ * @param shard The heap.
+ * @return 1 if the lock was taken, 0 if another thread holds it.
+ */
+int tryLockStealShard(StealShard *shard)
+{
+    int expected = 0;
+    return atomic_load_explicit(&shard->locked, memory_order_relaxed) == 0
+           && atomic_compare_exchange_strong_explicit(&shard->locked, &expected, 1,
+                                                      memory_order_acquire, memory_order_relaxed);
+}
+
+/**
+ * Takes the lock of a thread's heap. For the owner it is uncontended unless a thief is
+ * busy with the heap.
+ * @param shard The heap.
+ */
+void lockStealShard(StealShard *shard)
+{
+    int spins = 0;
+    while (!tryLockStealShard(shard))
+        backOff(&spins);
+}
+
+/**
+ * Publishes the new size of a thread's heap and releases its lock.
+ * @param shard The heap.
+ */
+void unlockStealShard(StealShard *shard)
+{
+    atomic_store_explicit(&shard->size, shard->heap.size, memory_order_relaxed);
+    atomic_store_explicit(&shard->locked, 0, memory_order_release);
+}
+
+/**
+ * Inserts a key into the calling thread's own heap.
+ * @param queue The StealQueue.
+ * @param thread Index of the calling thread.
+ * @param key The key to insert.
+ */
+void stealInsert(void *queue, int thread, int key)
+{
+    StealShard *own = &((StealQueue *)queue)->shards[thread];
+
+    lockStealShard(own);
+    insert(&own->heap, key);
+    unlockStealShard(own);
+    own->inserts++;
+}
+
+/**
+ * Takes the best half of another thread's heap, at most STEAL_BATCH keys, with one
+ * extractTop(). The best key is returned and the others go into the thief's own heap
+ * with one insertMany().
+ * @param own The heap of the thief, which must be empty.
+ * @param victim The heap to steal from, locked by the thief.
+ * @param key Where to store the best stolen key.
+ * @return 1 if keys were stolen, 0 if the victim was empty.
+ */
+int stealFrom(StealShard *own, StealShard *victim, int *key)
+{
+    int count = (victim->heap.size + 1) / 2;
+
+    if (count > STEAL_BATCH)
+        count = STEAL_BATCH;
+    count = extractTop(&victim->heap, own->batch, count);
+    unlockStealShard(victim);
+    if (count == 0)
+        return 0;
+
+    lockStealShard(own);
+    insertMany(&own->heap, own->batch + 1, count - 1);
+    unlockStealShard(own);
+    *key = own->batch[0];
+    own->steals++;
+    own->stolen += count;
+    return 1;
+}
+
+/**
+ * Extracts the maximum of the calling thread's own heap, or steals from random other
+ * heaps when it is empty. When random victims keep failing, all heaps are scanned once,
+ * waiting for their locks, before the queue is reported empty.
+ * @param queue The StealQueue.
+ * @param thread Index of the calling thread.
+ * @param key Where to store the extracted key.
+ * @return 1 if a key was extracted, 0 if every heap was empty.
+ */
+int stealExtract(void *queue, int thread, int *key)
+{
+    StealQueue *steal = queue;
+    StealShard *own = &steal->shards[thread];
+    StealShard *victim;
+    int attempt, i;
+
+    lockStealShard(own);
+    if (own->heap.size > 0)
+    {
+        *key = heapExtractMax(&own->heap);
+        unlockStealShard(own);
+        own->extracts++;
+        return 1;
+    }
+    unlockStealShard(own);
+
+    for (attempt = 0; attempt < steal->numShards; attempt++)
+    {
+        victim = &steal->shards[nextRandom(&own->seed) % (uint64_t)steal->numShards];
+        if (victim == own || atomic_load_explicit(&victim->size, memory_order_relaxed) == 0
+            || !tryLockStealShard(victim))
+        {
+            own->failedSteals++;
+            continue;
+        }
+        if (stealFrom(own, victim, key))
+        {
+            own->extracts++;
+            return 1;
+        }
+        own->failedSteals++;
+    }
+
+    /*the queue looks empty, make sure with a full scan*/
+    for (i = 0; i < steal->numShards; i++)
+    {
+        victim = &steal->shards[i];
+        if (atomic_load_explicit(&victim->size, memory_order_relaxed) == 0)
+            continue;
+        lockStealShard(victim);
+        if (victim == own)
+        {
+            /*a thief cannot have added keys, but stay correct if the owner did*/
+            if (own->heap.size > 0)
+            {
+                *key = heapExtractMax(&own->heap);
+                unlockStealShard(own);
+                own->extracts++;
+                return 1;
+            }
+            unlockStealShard(own);
+        }
+        else if (stealFrom(own, victim, key))
+        {
+            own->extracts++;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Prints the per-thread statistics of a StealQueue as CSV lines starting with '#',
+ * followed by a summary line with the share of extracts served by stealing.
+ * @param queue The StealQueue.
+ * @param out Where to print.
+ */
+void reportStealQueue(void *queue, FILE *out)
+{
+    StealQueue *steal = queue;
+    StealShard *shard;
+    long extracts = 0, steals = 0, stolen = 0, failed = 0;
+    int i;
+
+    fprintf(out, "# steal,threads,thread,inserts,extracts,steals,stolen,failed_steals\n");
+    for (i = 0; i < steal->numShards; i++)
+    {
+        shard = &steal->shards[i];
+        fprintf(out, "# steal,%d,%d,%ld,%ld,%ld,%ld,%ld\n", steal->numShards, i, shard->inserts,
+                shard->extracts, shard->steals, shard->stolen, shard->failedSteals);
+        extracts += shard->extracts;
+        steals += shard->steals;
+        stolen += shard->stolen;
+        failed += shard->failedSteals;
+    }
+    fprintf(out, "# steal,%d threads: %.2f%% of extracts stole, %.1f keys per steal, %ld failed attempts\n",
+            steal->numShards, extracts ? 100.0 * steals / extracts : 0.0,
+            steals ? (double)stolen / steals : 0.0, failed);
+}
+
+/**
+ * Releases a StealQueue.
+ * @param queue The StealQueue.
+ */
+void destroyStealQueue(void *queue)
+{
+    StealQueue *steal = queue;
+    int i;
+    for (i = 0; i < steal->numShards; i++)
+        freeHeap(&steal->shards[i].heap);
+    free(steal->shards);
+    free(steal);
+}
+
+/**
+ * Pushes a key onto a ring. Only the ring's producer may call this.
+ * @param ring The ring.
+ * @param key The key.
+ * @return 1 if the key was pushed, 0 if the ring is full.
+ */
+int pushRing(KeyRing *ring, int key)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+    if (head - ring->cachedTail == RING_SIZE)
+    {
+        ring->cachedTail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        if (head - ring->cachedTail == RING_SIZE)
+            return 0;
+    }
+    ring->keys[head & (RING_SIZE - 1)] = key;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return 1;
+}
+
+/**
+ * Pops keys off a ring. Only one consumer at a time may call this.
+ * @param ring The ring.
+ * @param keys Where to store the keys.
+ * @param max Most keys to pop.
+ * @return Number of keys popped.
+ */
+int popRing(KeyRing *ring, int *keys, int max)
+{
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    int count = head - tail < (size_t)max ? (int)(head - tail) : max;
+    int i;
+
+    for (i = 0; i < count; i++)
+        keys[i] = ring->keys[(tail + (size_t)i) & (RING_SIZE - 1)];
+    atomic_store_explicit(&ring->tail, tail + (size_t)count, memory_order_release);
+    return count;
+}
+
+/**
+ * Creates a heap fed through one ring per thread.
+ * @param d The degree of the heap.
+ * @param numThreads Number of threads that will use the queue.
+ * @return The new RingQueue.
+ */
+void *createRingQueue(int d, int numThreads)
+{
+    RingQueue *queue;
+    int i;
+
+    if (numThreads > MAX_THREADS)
+    {
+        fprintf(stderr, "Error: at most %d threads are supported\n", MAX_THREADS);
+        exit(EXIT_FAILURE);
+    }
+    queue = malloc(sizeof(RingQueue));
+    if (queue)
+        queue->rings = aligned_alloc(CACHE_LINE, (size_t)numThreads * sizeof(KeyRing));
+    if (!queue || !queue->rings)
+    {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < numThreads; i++)
+    {
+        atomic_init(&queue->rings[i].head, 0);
+        atomic_init(&queue->rings[i].tail, 0);
+        queue->rings[i].cachedTail = 0;
+    }
+    pthread_mutex_init(&queue->lock, NULL);
+    initHeap(&queue->heap, INITIAL_CAPACITY, d);
+    queue->numRings = numThreads;
+    queue->drains = 0;
+    queue->drainedKeys = 0;
+    queue->fullRings = 0;
+    return queue;
+}
+
+/**
+ * Moves every key queued on the rings into the heap, one insertMany() per batch.
+ * Must be called with the lock held.
+ * @param queue The RingQueue.
+ */
+void drainRings(RingQueue *queue)
+{
+    int count, i;
+
+    for (i = 0; i < queue->numRings; i++)
+        while ((count = popRing(&queue->rings[i], queue->drained, RING_SIZE)) > 0)
+        {
+            insertMany(&queue->heap, queue->drained, count);
+            queue->drains++;
+            queue->drainedKeys += count;
+        }
+}
+
+/**
+ * Inserts a key by pushing it onto the calling thread's ring. Only when the ring is full
+ * does the caller take the lock and drain the rings itself.
+ * @param queue The RingQueue.
+ * @param thread Index of the calling thread.
+ * @param key The key to insert.
+ */
+void ringInsert(void *queue, int thread, int key)
+{
+    RingQueue *ringQueue = queue;
+
+    while (!pushRing(&ringQueue->rings[thread], key))
+    {
+        pthread_mutex_lock(&ringQueue->lock);
+        drainRings(ringQueue);
+        ringQueue->fullRings++;
+        pthread_mutex_unlock(&ringQueue->lock);
+    }
+}
+
+/**
+ * Extracts the maximum of a RingQueue after draining the rings, so every key whose push
+ * completed before the call is taken into account.
+ * @param queue The RingQueue.
+ * @param thread Index of the calling thread, unused.
+ * @param key Where to store the extracted key.
+ * @return 1 if a key was extracted, 0 if the heap and the rings were empty.
+ */
+int ringExtract(void *queue, int thread, int *key)
+{
+    RingQueue *ringQueue = queue;
+    int found = 0;
+    (void)thread;
+
+    pthread_mutex_lock(&ringQueue->lock);
+    drainRings(ringQueue);
+    if (ringQueue->heap.size > 0)
+    {
+        *key = heapExtractMax(&ringQueue->heap);
+        found = 1;
+    }
+    pthread_mutex_unlock(&ringQueue->lock);
+    return found;
+}
+
+/**
+ * Prints the statistics of a RingQueue as a line starting with '#'.
+ * @param queue The RingQueue.
+ * @param out Where to print.
+ */
+void reportRingQueue(void *queue, FILE *out)
+{
+    RingQueue *ringQueue = queue;
+    fprintf(out, "# ring,%d threads: %ld keys in %ld batches, %.1f keys per batch, %ld full rings\n",
+            ringQueue->numRings, ringQueue->drainedKeys, ringQueue->drains,
+            ringQueue->drains ? (double)ringQueue->drainedKeys / ringQueue->drains : 0.0,
+            ringQueue->fullRings);
+}
+
+/**
+ * Releases a RingQueue.
+ * @param queue The RingQueue.
+ */
+void destroyRingQueue(void *queue)
+{
+    RingQueue *ringQueue = queue;
+    pthread_mutex_destroy(&ringQueue->lock);
+    freeHeap(&ringQueue->heap);
+    free(ringQueue->rings);
+    free(ringQueue);
+}
+
+/* Concurrent priority queues known to the concurrency benchmark*/
+static const ConcurrentEngine engines[] = {
+    { "lock", 1, createLockedHeap, lockedInsert, lockedExtract, destroyLockedHeap, NULL },
+    { "fc", 1, createCombiningHeap, combiningInsert, combiningExtract, destroyCombiningHeap, NULL },
+    { "hunt", 1, createHuntHeap, huntInsert, huntExtract, destroyHuntHeap, NULL },
+    { "mq", 0, createMultiQueue, multiQueueInsert, multiQueueExtract, destroyMultiQueue, NULL },
+    { "steal", 0, createStealQueue, stealInsert, stealExtract, destroyStealQueue, reportStealQueue },
+    { "ring", 1, createRingQueue, ringInsert, ringExtract, destroyRingQueue, reportRingQueue }
+};
+
+/**
+ * Looks up a concurrent priority queue by name.
+ * @param name Name of the implementation.
+ * @return The implementation, or NULL if there is none with this name.
+ */
+const ConcurrentEngine *findEngine(const char *name)
+{
+    size_t i;
+    for (i = 0; i < sizeof(engines) / sizeof(engines[0]); i++)
+        if (strcmp(engines[i].name, name) == 0)
+            return &engines[i];
+    return NULL;
+}
+
+/**
+ * Thread body of the concurrency benchmark: an even random mix of inserts and extracts.
+ * @param arg Pointer to the BenchThread of the thread.
+ * @return Always NULL.
+ */
+void *benchThread(void *arg)
+{
+    BenchThread *work = arg;
+    uint64_t random;
+    long i;
+    int key;
+
+    pthread_barrier_wait(work->start);
+    for (i = 0; i < work->operations; i++)
+    {
+        random = nextRandom(&work->seed);
+        if (work->split ? work->thread % 2 == 0 : (random & 1))
+            work->engine->insert(work->queue, work->thread, (int)(random >> 33));
+        else
+            work->engine->extract(work->queue, work->thread, &key);
+    }
+    return NULL;
+}
+
+/**
+ * Times one run of the concurrency benchmark.
+ * @param engine The implementation to run.
+ * @param d The degree of the heaps.
+ * @param numThreads Number of threads.
+ * @param operations Total number of operations, split evenly over the threads.
+ * @param prefill Number of keys inserted before the clock starts.
+ * @param split 1 to make even threads producers and odd threads consumers.
+ * @param verbose 1 to print the statistics of the queue to stderr after the run.
+ * @return The elapsed time in seconds.
+ */
+double runConcurrentTrial(const ConcurrentEngine *engine, int d, int numThreads, long operations, int prefill, int split, int verbose)
+{
+    BenchThread *work = malloc((size_t)numThreads * sizeof(BenchThread));
+    pthread_t *threads = malloc((size_t)numThreads * sizeof(pthread_t));
+    pthread_barrier_t start;
+    uint64_t seed = 88172645463325252ULL;
+    uint64_t begin = 0;
+    void *queue;
+    int i;
+
+    if (!work || !threads)
+    {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    queue = engine->create(d, numThreads);
+    for (i = 0; i < prefill; i++)
+        engine->insert(queue, i % numThreads, (int)(nextRandom(&seed) >> 33));
+
+    pthread_barrier_init(&start, NULL, (unsigned int)numThreads + 1);
+    for (i = 0; i < numThreads; i++)
+    {
+        work[i].engine = engine;
+        work[i].queue = queue;
+        work[i].thread = i;
+        work[i].operations = operations / numThreads;
+        work[i].split = split;
+        work[i].seed = 0x9E3779B97F4A7C15ULL * (uint64_t)(i + 1);
+        work[i].start = &start;
+        if (pthread_create(&threads[i], NULL, benchThread, &work[i]) != 0)
+        {
+            fprintf(stderr, "Error: cannot create thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    begin = nowNanoseconds();
+    pthread_barrier_wait(&start);
+    for (i = 0; i < numThreads; i++)
+        pthread_join(threads[i], NULL);
+    begin = nowNanoseconds() - begin;
+
+    pthread_barrier_destroy(&start);
+    if (verbose && engine->report)
+        engine->report(queue, stderr);
+    engine->destroy(queue);
+    free(work);
+    free(threads);
+    return begin / 1e9;
+}
+
+/**
+ * Adds to the count of one key in a Fenwick tree over all possible keys.
+ * @param tree The tree, with 2^RANK_KEY_BITS + 1 entries.
+ * @param key The key, below 2^RANK_KEY_BITS.
+ * @param delta 1 when the key is inserted, -1 when it is removed.
+ */
+void addRank(int *tree, int key, int delta)
+{
+    int i;
+    for (i = key + 1; i <= 1 << RANK_KEY_BITS; i += i & -i)
+        tree[i] += delta;
+}
+
+/**
+ * Counts the keys in a Fenwick tree that are larger than a given key.
+ * @param tree The tree, with 2^RANK_KEY_BITS + 1 entries.
+ * @param key The key, below 2^RANK_KEY_BITS.
+ * @return Number of keys greater than key.
+ */
+long countAbove(const int *tree, int key)
+{
+    long total = 0, upTo = 0;
+    int i;
+    for (i = 1 << RANK_KEY_BITS; i > 0; i -= i & -i)
+        total += tree[i];
+    for (i = key + 1; i > 0; i -= i & -i)
+        upTo += tree[i];
+    return total - upTo;
+}
+
+/**
+ * Measures how far from the true maximum a queue extracts. The operations of numThreads
+ * threads are interleaved on one thread, and after every extract the number of keys still in
+ * the queue that are larger than the extracted one (its rank error) is looked up in a Fenwick
+ * tree. A strict heap always scores 0. Prints one CSV line.
+ * @param engine The implementation to measure.
+ * @param d The degree of the heaps.
+ * @param numThreads Number of simulated threads, which sets the number of MultiQueue heaps.
+ * @param operations Number of operations after the prefill, an even random mix.
+ * @param prefill Number of keys inserted first.
+ */
+void measureRankError(const ConcurrentEngine *engine, int d, int numThreads, long operations, int prefill)
+{
+    int *tree = calloc(((size_t)1 << RANK_KEY_BITS) + 1, sizeof(int));
+    void *queue = engine->create(d, numThreads);
+    uint64_t seed = 88172645463325252ULL;
+    uint64_t random;
+    long extracts = 0, rank, totalRank = 0, maxRank = 0;
+    long i;
+    int key;
+
+    if (!tree)
+    {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < prefill + operations; i++)
+    {
+        random = nextRandom(&seed);
+        if (i < prefill || (random & 1))
+        {
+            key = (int)((random >> 32) & ((1u << RANK_KEY_BITS) - 1));
+            engine->insert(queue, (int)(i % numThreads), key);
+            addRank(tree, key, 1);
+        }
+        else if (engine->extract(queue, (int)(i % numThreads), &key))
+        {
+            addRank(tree, key, -1);
+            rank = countAbove(tree, key);
+            totalRank += rank;
+            if (rank > maxRank)
+                maxRank = rank;
+            extracts++;
+        }
+    }
+
+    printf("%s,%d,%ld,%.3f,%ld\n", engine->name, numThreads, extracts,
+           extracts ? (double)totalRank / extracts : 0.0, maxRank);
+    engine->destroy(queue);
+    free(tree);
+}
+
+/**
+ * Measures how the concurrent priority queues scale with the number of threads.
+ * Every thread runs an even random mix of inserts and extracts on one shared queue;
+ * thread counts double from 1 up to the maximum, and one CSV line is printed per run.
+ * With -w even threads only insert and odd threads only extract, which is what makes
+ * per-thread queues steal. With -r the rank error of every queue is measured instead of
+ * its throughput, and with -v queues that keep statistics print them to stderr after every run.
+ * Usage: cbench [-t MAX_THREADS] [-n OPERATIONS] [-d D] [-s PREFILL] [-r] [-w] [-v] [-e ENGINE]...
+ * @param argc Number of arguments, argv[0] being "cbench".
+ * @param argv The arguments.
+ * @return The exit status of the program.
+ */
+int runConcurrentBenchmark(int argc, const char *argv[])
+{
+    const ConcurrentEngine *selected[sizeof(engines) / sizeof(engines[0])];
+    int numSelected = 0;
+    int maxThreads = 64, d = 4, prefill = 100000, rankError = 0, split = 0, verbose = 0;
+    long operations = 2000000;
+    double seconds;
+    int threads, i;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            maxThreads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc && atol(argv[i + 1]) > 0)
+            operations = atol(argv[++i]);
+        else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            d = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc && atoi(argv[i + 1]) >= 0)
+            prefill = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-r") == 0)
+            rankError = 1;
+        else if (strcmp(argv[i], "-w") == 0)
+            split = 1;
+        else if (strcmp(argv[i], "-v") == 0)
+            verbose = 1;
+        else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc && findEngine(argv[i + 1])
+                 && numSelected < (int)(sizeof(selected) / sizeof(selected[0])))
+            selected[numSelected++] = findEngine(argv[++i]);
+        else
+            break;
+    }
+    if (i < argc || maxThreads > MAX_THREADS)
+    {
+        fprintf(stderr, "Usage: cbench [-t MAX_THREADS] [-n OPERATIONS] [-d D] [-s PREFILL] [-r] [-w] [-v] [-e ENGINE]...\n");
+        fprintf(stderr, "Engines:");
+        for (i = 0; i < (int)(sizeof(engines) / sizeof(engines[0])); i++)
+            fprintf(stderr, " %s", engines[i].name);
+        fprintf(stderr, "\n");
+        return EXIT_FAILURE;
+    }
+    if (numSelected == 0)
+        for (i = 0; i < (int)(sizeof(engines) / sizeof(engines[0])); i++)
+            selected[numSelected++] = &engines[i];
+
+    if (rankError)
+        printf("engine,threads,extracts,mean_rank_error,max_rank_error\n");
+    else
+        printf("engine,threads,operations,seconds,mops\n");
+    for (threads = 1; threads <= maxThreads; threads = threads < maxThreads && threads * 2 > maxThreads ? maxThreads : threads * 2)
+    {
+        for (i = 0; i < numSelected; i++)
+        {
+            if (rankError)
+            {
+                measureRankError(selected[i], d, threads, operations, prefill);
+                continue;
+            }
+            seconds = runConcurrentTrial(selected[i], d, threads, operations, prefill, split, verbose);
+            printf("%s,%d,%ld,%.4f,%.3f\n", selected[i]->name, threads, operations / threads * threads,
+                   seconds, operations / threads * threads / seconds / 1e6);
+            fflush(stdout);
+        }
+        if (threads == maxThreads)
+            break;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Runs one stress test thread. In the mixed phase the thread inserts keys unique to it and
+ * extracts at random; after all threads reach the barrier they drain the queue together.
+ * With only extracts running, a linearizable max-heap must return non-increasing keys to
+ * each thread, so every increase is counted as an order error.
+ * @param arg The StressThread.
+ * @return NULL.
+ */
+void *stressThread(void *arg)
+{
+    StressThread *work = arg;
+    int key, previous = INT_MAX;
+    long i;
+
+    for (i = 0; i < work->operations; i++)
+    {
+        if (nextRandom(&work->seed) & 1)
+        {
+            /*keys are unique across threads and spread over the whole range*/
+            key = (int)(((uint32_t)(work->numInserted * work->numThreads + work->thread) * 2654435761u) & INT_MAX);
+            work->engine->insert(work->queue, work->thread, key);
+            work->inserted[work->numInserted++] = key;
+        }
+        else if (work->engine->extract(work->queue, work->thread, &key))
+            work->extracted[atomic_fetch_add(work->numExtracted, 1)] = key;
+    }
+
+    pthread_barrier_wait(work->phase);
+    while (work->engine->extract(work->queue, work->thread, &key))
+    {
+        if (key > previous)
+            work->orderErrors++;
+        previous = key;
+        work->extracted[atomic_fetch_add(work->numExtracted, 1)] = key;
+    }
+    return NULL;
+}
+
+/**
+ * Compares two ints for qsort.
+ * @param a Pointer to the first int.
+ * @param b Pointer to the second int.
+ * @return Negative, zero or positive as a is smaller, equal or larger.
+ */
+int compareInt(const void *a, const void *b)
+{
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Stresses one concurrent priority queue and checks what any linearizable max-heap must do:
+ * every inserted key is extracted exactly once, nothing else is extracted, the queue is
+ * empty once drained, and while only extracts run each thread sees non-increasing keys.
+ * Order errors are only failures for strict engines. Prints one CSV line.
+ * @param engine The implementation to test.
+ * @param d The degree of the heaps.
+ * @param numThreads Number of threads.
+ * @param operations Number of operations of the mixed phase, over all threads.
+ * @return 1 if the queue passed, 0 otherwise.
+ */
+int runStressTrial(const ConcurrentEngine *engine, int d, int numThreads, long operations)
+{
+    StressThread *work = calloc((size_t)numThreads, sizeof(StressThread));
+    pthread_t *threads = malloc((size_t)numThreads * sizeof(pthread_t));
+    int *inserted = malloc((size_t)operations * sizeof(int));
+    int *extracted = malloc((size_t)operations * sizeof(int));
+    atomic_long numExtracted = 0;
+    pthread_barrier_t phase;
+    long numInserted = 0, lost = 0, duplicated = 0, orderErrors = 0;
+    long i, j;
+    void *queue;
+    int key, passed;
+
+    if (!work || !threads || !inserted || !extracted)
+    {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    queue = engine->create(d, numThreads);
+    pthread_barrier_init(&phase, NULL, (unsigned int)numThreads);
+    for (i = 0; i < numThreads; i++)
+    {
+        work[i].engine = engine;
+        work[i].queue = queue;
+        work[i].thread = (int)i;
+        work[i].numThreads = numThreads;
+        work[i].operations = operations / numThreads;
+        work[i].seed = 0x9E3779B97F4A7C15ULL * (uint64_t)(i + 1);
+        work[i].phase = &phase;
+        work[i].inserted = inserted + i * (operations / numThreads);
+        work[i].extracted = extracted;
+        work[i].numExtracted = &numExtracted;
+        if (pthread_create(&threads[i], NULL, stressThread, &work[i]) != 0)
+        {
+            fprintf(stderr, "Error: cannot create thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (i = 0; i < numThreads; i++)
+        pthread_join(threads[i], NULL);
+    pthread_barrier_destroy(&phase);
+
+    /*gather the inserted keys and match them against the extracted ones*/
+    for (i = 0; i < numThreads; i++)
+    {
+        memmove(inserted + numInserted, work[i].inserted, (size_t)work[i].numInserted * sizeof(int));
+        numInserted += work[i].numInserted;
+        orderErrors += work[i].orderErrors;
+    }
+    qsort(inserted, (size_t)numInserted, sizeof(int), compareInt);
+    qsort(extracted, (size_t)numExtracted, sizeof(int), compareInt);
+    for (i = 0, j = 0; i < numInserted || j < numExtracted; )
+    {
+        if (j == numExtracted || (i < numInserted && inserted[i] < extracted[j]))
+            lost++, i++;
+        else if (i == numInserted || extracted[j] < inserted[i])
+            duplicated++, j++;
+        else
+            i++, j++;
+    }
+    if (engine->extract(queue, 0, &key))
+        lost = lost ? lost : 1;   /*a key the drain did not see*/
+
+    passed = !lost && !duplicated && (!engine->strict || !orderErrors);
+    printf("%s,%d,%ld,%ld,%ld,%ld,%s\n", engine->name, numThreads, numInserted, lost, duplicated,
+           orderErrors, passed ? "pass" : "FAIL");
+    fflush(stdout);
+
+    engine->destroy(queue);
+    free(work);
+    free(threads);
+    free(inserted);
+    free(extracted);
+    return passed;
+}
+
+/**
+ * Stress tests the concurrent priority queues for 1, 2, 4, ... up to the maximum number of
+ * threads, repeating every run a number of times since interleavings differ between runs.
+ * Usage: stress [-t MAX_THREADS] [-n OPERATIONS] [-d D] [-i ITERATIONS] [-e ENGINE]...
+ * @param argc Number of arguments, argv[0] being "stress".
+ * @param argv The arguments.
+ * @return EXIT_SUCCESS if every run passed, EXIT_FAILURE otherwise.
+ */
+int runStressTest(int argc, const char *argv[])
+{
+    const ConcurrentEngine *selected[sizeof(engines) / sizeof(engines[0])];
+    int numSelected = 0;
+    int maxThreads = 8, d = 4, iterations = 3, failures = 0;
+    long operations = 200000;
+    int threads, iteration, i;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            maxThreads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc && atol(argv[i + 1]) > 0)
+            operations = atol(argv[++i]);
+        else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            d = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            iterations = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc && findEngine(argv[i + 1])
+                 && numSelected < (int)(sizeof(selected) / sizeof(selected[0])))
+            selected[numSelected++] = findEngine(argv[++i]);
+        else
+            break;
+    }
+    if (i < argc || maxThreads > MAX_THREADS)
+    {
+        fprintf(stderr, "Usage: stress [-t MAX_THREADS] [-n OPERATIONS] [-d D] [-i ITERATIONS] [-e ENGINE]...\n");
+        return EXIT_FAILURE;
+    }
+    if (numSelected == 0)
+        for (i = 0; i < (int)(sizeof(engines) / sizeof(engines[0])); i++)
+            selected[numSelected++] = &engines[i];
+
+    printf("engine,threads,keys,lost,duplicated,order_errors,result\n");
+    for (threads = 1; threads <= maxThreads; threads = threads < maxThreads && threads * 2 > maxThreads ? maxThreads : threads * 2)
+    {
+        for (i = 0; i < numSelected; i++)
+            for (iteration = 0; iteration < iterations; iteration++)
+                if (!runStressTrial(selected[i], d, threads, operations))
+                    failures++;
+        if (threads == maxThreads)
+            break;
+    }
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/**
+ * Initializes an empty blocking queue. Timed waits use CLOCK_MONOTONIC, so setting the
+ * wall clock does not stretch or cut short a timeout.
+ * @param queue The queue to initialize.
+ * @param d The degree of the heap.
+ */
+void initBlockingHeap(BlockingHeap *queue, int d)
+{
+    pthread_condattr_t attributes;
+
+    initHeap(&queue->heap, INITIAL_CAPACITY, d);
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    pthread_cond_init(&queue->notEmpty, &attributes);
+    pthread_condattr_destroy(&attributes);
+    queue->waiters = 0;
+    queue->pendingWakeups = 0;
+    queue->closed = 0;
+    queue->signals = 0;
+    queue->wakeups = 0;
+    queue->emptyWakeups = 0;
+}
+
+/**
+ * Wakes up to count waiting consumers that have not been signaled already. Must be called
+ * with the lock held.
+ * @param queue The queue.
+ * @param count Number of new keys.
+ */
+void wakeConsumers(BlockingHeap *queue, int count)
+{
+    int idle = queue->waiters - queue->pendingWakeups;
+    int wake = count < idle ? count : idle;
+    int i;
+
+    for (i = 0; i < wake; i++)
+        pthread_cond_signal(&queue->notEmpty);
+    queue->pendingWakeups += wake;
+    queue->signals += wake;
+}
+
+/**
+ * Inserts a key into a blocking queue and wakes one waiting consumer, if there is one.
+ * @param queue The queue.
+ * @param key The key to insert.
+ */
+void blockingInsert(BlockingHeap *queue, int key)
+{
+    pthread_mutex_lock(&queue->lock);
+    insert(&queue->heap, key);
+    wakeConsumers(queue, 1);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+/**
+ * Inserts several keys into a blocking queue with one insertMany() and wakes as many
+ * waiting consumers as there are new keys, never more: a broadcast would wake every
+ * consumer to fight over a few keys.
+ * @param queue The queue.
+ * @param keys The keys to insert.
+ * @param count Number of keys.
+ */
+void blockingInsertMany(BlockingHeap *queue, const int *keys, int count)
+{
+    pthread_mutex_lock(&queue->lock);
+    insertMany(&queue->heap, keys, count);
+    wakeConsumers(queue, count);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+/**
+ * Extracts the maximum of a blocking queue, waiting for a key if the queue is empty.
+ * Keys still queued when the queue is closed are handed out before closing is reported.
+ * @param queue The queue.
+ * @param key Where to store the extracted key.
+ * @param timeoutMs Longest wait in milliseconds, 0 not to wait, WAIT_FOREVER (or any negative value) for no limit.
+ * @return 1 if a key was extracted, 0 if the timeout expired, -1 if the queue is closed and empty.
+ */
+int blockingExtract(BlockingHeap *queue, int *key, long timeoutMs)
+{
+    struct timespec deadline;
+    int result = 1, error = 0;
+
+    if (timeoutMs > 0)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += timeoutMs / 1000;
+        deadline.tv_nsec += timeoutMs % 1000 * 1000000;
+        if (deadline.tv_nsec >= 1000000000)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+    }
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->heap.size == 0 && !queue->closed && timeoutMs != 0 && error != ETIMEDOUT)
+    {
+        queue->waiters++;
+        if (timeoutMs < 0)
+            error = pthread_cond_wait(&queue->notEmpty, &queue->lock);
+        else
+            error = pthread_cond_timedwait(&queue->notEmpty, &queue->lock, &deadline);
+        queue->waiters--;
+        if (queue->pendingWakeups > 0)
+            queue->pendingWakeups--;
+        queue->wakeups++;
+        if (queue->heap.size == 0)
+            queue->emptyWakeups++;
+    }
+
+    if (queue->heap.size > 0)
+        *key = heapExtractMax(&queue->heap);
+    else
+        result = queue->closed ? -1 : 0;
+    pthread_mutex_unlock(&queue->lock);
+    return result;
+}
+
+/**
+ * Extracts the maximum of a blocking queue if it has one, without waiting. Unlike
+ * heapExtractMax() an empty queue is not an error.
+ * @param queue The queue.
+ * @param key Where to store the extracted key.
+ * @return 1 if a key was extracted, 0 if the queue is empty, -1 if it is also closed.
+ */
+int tryBlockingExtract(BlockingHeap *queue, int *key)
+{
+    return blockingExtract(queue, key, 0);
+}
+
+/**
+ * Closes a blocking queue: waiting consumers wake up, and once the remaining keys are
+ * gone every extract returns -1 instead of waiting.
+ * @param queue The queue.
+ */
+void closeBlockingHeap(BlockingHeap *queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    queue->closed = 1;
+    queue->pendingWakeups = queue->waiters;
+    pthread_cond_broadcast(&queue->notEmpty);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+/**
+ * Releases a blocking queue. No thread may still be using it.
+ * @param queue The queue.
+ */
+void freeBlockingHeap(BlockingHeap *queue)
+{
+    pthread_cond_destroy(&queue->notEmpty);
+    pthread_mutex_destroy(&queue->lock);
+    freeHeap(&queue->heap);
+}
+
+/**
+ * Runs one producer of the blocking queue benchmark, inserting its keys in batches.
+ * @param arg The BlockingThread.
+ * @return NULL.
+ */
+void *blockingProducer(void *arg)
+{
+    BlockingThread *work = arg;
+    int *keys = malloc((size_t)work->batch * sizeof(int));
+    long done;
+    int count, i;
+
+    if (!keys)
+    {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (done = 0; done < work->keys; done += count)
+    {
+        count = work->keys - done < work->batch ? (int)(work->keys - done) : work->batch;
+        for (i = 0; i < count; i++)
+            keys[i] = (int)(nextRandom(&work->seed) >> 33);
+        if (count == 1)
+            blockingInsert(work->queue, keys[0]);
+        else
+            blockingInsertMany(work->queue, keys, count);
+    }
+    free(keys);
+    return NULL;
+}
+
+/**
+ * Runs one consumer of the blocking queue benchmark, extracting until the queue closes.
+ * @param arg The BlockingThread.
+ * @return NULL.
+ */
+void *blockingConsumer(void *arg)
+{
+    BlockingThread *work = arg;
+    int key;
+
+    while (blockingExtract(work->queue, &key, WAIT_FOREVER) == 1)
+        work->extracted++;
+    return NULL;
+}
+
+/**
+ * Measures a blocking queue shared by producers and consumers that sleep while it is empty.
+ * Producers insert their keys in batches, then the queue is closed and the consumers drain
+ * it. Prints one CSV line with the time, the signals sent and the wakeups that found the
+ * queue empty.
+ * Usage: qbench [-p PRODUCERS] [-c CONSUMERS] [-n KEYS] [-b BATCH] [-d D]
+ * @param argc Number of arguments, argv[0] being "qbench".
+ * @param argv The arguments.
+ * @return The exit status of the program.
+ */
+int runBlockingBenchmark(int argc, const char *argv[])
+{
+    BlockingHeap queue;
+    BlockingThread work[2 * MAX_THREADS];
+    pthread_t threads[2 * MAX_THREADS];
+    int producers = 2, consumers = 4, batch = 1, d = 4;
+    long keys = 1000000, extracted = 0;
+    uint64_t begin;
+    int i;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-p") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            producers = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            consumers = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc && atol(argv[i + 1]) > 0)
+            keys = atol(argv[++i]);
+        else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            batch = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            d = atoi(argv[++i]);
+        else
+            break;
+    }
+    if (i < argc || producers > MAX_THREADS || consumers > MAX_THREADS)
+    {
+        fprintf(stderr, "Usage: qbench [-p PRODUCERS] [-c CONSUMERS] [-n KEYS] [-b BATCH] [-d D]\n");
+        return EXIT_FAILURE;
+    }
+
+    initBlockingHeap(&queue, d);
+    memset(work, 0, sizeof(work));
+    begin = nowNanoseconds();
+    for (i = 0; i < producers + consumers; i++)
+    {
+        work[i].queue = &queue;
+        work[i].keys = i < producers ? keys / producers : 0;
+        work[i].batch = batch;
+        work[i].seed = 0x9E3779B97F4A7C15ULL * (uint64_t)(i + 1);
+        if (pthread_create(&threads[i], NULL, i < producers ? blockingProducer : blockingConsumer, &work[i]) != 0)
+        {
+            fprintf(stderr, "Error: cannot create thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (i = 0; i < producers; i++)
+        pthread_join(threads[i], NULL);
+    closeBlockingHeap(&queue);
+    for (i = producers; i < producers + consumers; i++)
+    {
+        pthread_join(threads[i], NULL);
+        extracted += work[i].extracted;
+    }
+    begin = nowNanoseconds() - begin;
+
+    printf("producers,consumers,batch,keys,seconds,signals,wakeups,empty_wakeups\n");
+    printf("%d,%d,%d,%ld,%.4f,%ld,%ld,%ld\n", producers, consumers, batch, extracted, begin / 1e9,
+           queue.signals, queue.wakeups, queue.emptyWakeups);
+    freeBlockingHeap(&queue);
+    return extracted == keys / producers * producers ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * Creates a POSIX shared-memory segment holding an empty heap, which any local process can then
+ * attach to by name with attachSharedHeap(). The capacity is fixed: a process cannot follow
+ * another one to a larger mapping while it is in the middle of an operation.
+ * @param name Name of the segment, as for shm_open().
+ * @param capacity Number of keys the heap can hold.
+ * @param d The degree of the heap.
+ */
+void createSharedHeap(const char *name, int capacity, int d)
+{
+    SharedHeapHeader *header;
+    pthread_mutexattr_t lockAttributes;
+    pthread_condattr_t waitAttributes;
+    uint64_t keysOffset = (sizeof(SharedHeapHeader) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+    size_t length = keysOffset + (size_t)capacity * sizeof(int);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+
+    if (fd < 0)
+    {
+        perror("Error creating shared heap");
+        exit(EXIT_FAILURE);
+    }
+    header = ftruncate(fd, (off_t)length) == 0 ? mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (header == MAP_FAILED)
+    {
+        perror("Error creating shared heap");
+        shm_unlink(name);
+        exit(EXIT_FAILURE);
+    }
+
+    header->version = SHARED_HEAP_VERSION;
+    header->d = d;
+    header->capacity = capacity;
+    header->keysOffset = keysOffset;
+    pthread_mutexattr_init(&lockAttributes);
+    pthread_mutexattr_setpshared(&lockAttributes, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&lockAttributes, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&header->lock, &lockAttributes);
+    pthread_mutexattr_destroy(&lockAttributes);
+    pthread_condattr_init(&waitAttributes);
+    pthread_condattr_setpshared(&waitAttributes, PTHREAD_PROCESS_SHARED);
+    pthread_condattr_setclock(&waitAttributes, CLOCK_MONOTONIC);
+    pthread_cond_init(&header->notEmpty, &waitAttributes);
+    pthread_condattr_destroy(&waitAttributes);
+    atomic_thread_fence(memory_order_release); /*a process that sees the magic sees an initialized segment*/
+    memcpy(header->magic, SHARED_HEAP_MAGIC, sizeof(header->magic));
+    munmap(header, length);
+}
+
+/**
+ * Maps a shared-memory heap created by createSharedHeap() into this process. Its keys are
+ * used in place: the heap operations run directly on the shared pages.
+ * @param shared The handle to initialize.
+ * @param name Name of the segment.
+ */
+void attachSharedHeap(SharedHeap *shared, const char *name)
+{
+    SharedHeapHeader *header;
+    struct stat info;
+    int fd = shm_open(name, O_RDWR, 0);
+
+    if (fd < 0 || fstat(fd, &info) != 0)
+    {
+        perror("Error opening shared heap");
+        exit(EXIT_FAILURE);
+    }
+    header = (size_t)info.st_size >= sizeof(SharedHeapHeader)
+             ? mmap(NULL, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (header == MAP_FAILED || memcmp(header->magic, SHARED_HEAP_MAGIC, sizeof(header->magic)) != 0
+        || header->version != SHARED_HEAP_VERSION
+        || header->keysOffset + (uint64_t)header->capacity * sizeof(int) > (uint64_t)info.st_size)
+    {
+        fprintf(stderr, "Error: %s is not a shared heap\n", name);
+        exit(EXIT_FAILURE);
+    }
+    atomic_thread_fence(memory_order_acquire);
+
+    shared->header = header;
+    shared->length = (size_t)info.st_size;
+    shared->heap.array = (int *)((char *)header + header->keysOffset);
+    shared->heap.size = 0;
+    shared->heap.capacity = header->capacity;
+    shared->heap.d = header->d;
+    shared->heap.storage = HEAP_STORAGE_SHARED;
+    shared->heap.header = NULL;
+    shared->heap.mappedLength = 0;
+    shared->heap.fd = -1;
+    shared->heap.trace = NULL;
+    shared->heap.log = NULL;
+    resetChanges(&shared->heap);
+    resetHeapStats(&shared->heap);
+}
+
+/**
+ * Unmaps a shared-memory heap from this process. The segment and its keys stay for the
+ * other processes until it is removed with shm_unlink().
+ * @param shared The attached heap.
+ */
+void detachSharedHeap(SharedHeap *shared)
+{
+    munmap(shared->header, shared->length);
+    shared->header = NULL;
+    shared->heap.array = NULL;
+}
+
+/**
+ * Makes a shared heap usable again after a process died holding its lock, which the robust
+ * mutex reports to the next owner with EOWNERDEAD. The size in the header is only stored
+ * by complete operations, but the dead process may have been in the middle of a sift, so the
+ * keys are heapified again; the key it was moving may have been lost or doubled.
+ * Must be called with the lock held.
+ * @param shared The attached heap.
+ */
+void repairSharedHeap(SharedHeap *shared)
+{
+    pthread_mutex_consistent(&shared->header->lock);
+    shared->heap.size = shared->header->size;
+    buildMaxHeap(&shared->heap);
+    shared->header->recoveries++;
+}
+
+/**
+ * Takes the lock of a shared heap and loads its size, so the heap operations can run on it.
+ * @param shared The attached heap.
+ */
+void lockSharedHeap(SharedHeap *shared)
+{
+    int error = pthread_mutex_lock(&shared->header->lock);
+
+    if (error == EOWNERDEAD)
+        repairSharedHeap(shared);
+    else if (error != 0)
+    {
+        fprintf(stderr, "Error: cannot lock shared heap: %s\n", strerror(error));
+        exit(EXIT_FAILURE);
+    }
+    shared->heap.size = shared->header->size;
+}
+
+/**
+ * Stores the size of a shared heap and releases its lock.
+ * @param shared The attached heap, locked with lockSharedHeap().
+ */
+void unlockSharedHeap(SharedHeap *shared)
+{
+    shared->header->size = shared->heap.size;
+    pthread_mutex_unlock(&shared->header->lock);
+}
+
+/**
+ * Inserts keys into a shared heap with one insertMany() under one lock, and wakes as many
+ * waiting processes as there are new keys.
+ * @param shared The attached heap.
+ * @param keys The keys to insert.
+ * @param count Number of keys.
+ * @return Number of keys inserted, fewer than count if the heap filled up.
+ */
+int sharedInsert(SharedHeap *shared, const int *keys, int count)
+{
+    SharedHeapHeader *header = shared->header;
+    int i;
+
+    lockSharedHeap(shared);
+    if (count > shared->heap.capacity - shared->heap.size)
+        count = shared->heap.capacity - shared->heap.size;
+    insertMany(&shared->heap, keys, count);
+    header->inserts += count;
+    for (i = 0; i < count && i < header->waiters; i++)
+        pthread_cond_signal(&header->notEmpty);
+    unlockSharedHeap(shared);
+    return count;
+}
+
+/**
+ * Extracts the maximum of a shared heap, waiting for another process to insert a key if it is
+ * empty. Keys still in the heap when it is closed are handed out before closing is reported.
+ * @param shared The attached heap.
+ * @param key Where to store the extracted key.
+ * @param timeoutMs Longest wait in milliseconds, 0 not to wait, WAIT_FOREVER (or any negative value) for no limit.
+ * @return 1 if a key was extracted, 0 if the timeout expired, -1 if the heap is closed and empty.
+ */
+int sharedExtract(SharedHeap *shared, int *key, long timeoutMs)
+{
+    SharedHeapHeader *header = shared->header;
+    struct timespec deadline;
+    int result = 1, error = 0;
+
+    if (timeoutMs > 0)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += timeoutMs / 1000;
+        deadline.tv_nsec += timeoutMs % 1000 * 1000000;
+        if (deadline.tv_nsec >= 1000000000)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+    }
+
+    lockSharedHeap(shared);
+    while (header->size == 0 && !header->closed && timeoutMs != 0 && error != ETIMEDOUT)
+    {
+        header->waiters++;
+        if (timeoutMs < 0)
+            error = pthread_cond_wait(&header->notEmpty, &header->lock);
+        else
+            error = pthread_cond_timedwait(&header->notEmpty, &header->lock, &deadline);
+        if (error == EOWNERDEAD)
+            repairSharedHeap(shared);
+        header->waiters--;
+    }
+
+    shared->heap.size = header->size;
+    if (shared->heap.size > 0)
+    {
+        *key = heapExtractMax(&shared->heap);
+        header->extracts++;
+    }
+    else
+        result = header->closed ? -1 : 0;
+    unlockSharedHeap(shared);
+    return result;
+}
+
+/**
+ * Closes a shared heap: waiting processes wake up, and once the remaining keys are gone
+ * every extract returns -1 instead of waiting.
+ * @param shared The attached heap.
+ */
+void closeSharedHeap(SharedHeap *shared)
+{
+    lockSharedHeap(shared);
+    shared->header->closed = 1;
+    pthread_cond_broadcast(&shared->header->notEmpty);
+    unlockSharedHeap(shared);
+}
+
+/**
+ * Runs producer and consumer processes on a shared heap. Every process is forked and attaches
+ * to the segment by name, as an unrelated process would. The producers insert their keys in
+ * batches, then the heap is closed and the consumers drain it.
+ * @param shared The heap, attached to this process.
+ * @param name Name of the segment.
+ * @param producers Number of producer processes.
+ * @param consumers Number of consumer processes.
+ * @param keys Keys inserted by all producers together.
+ * @param batch Keys a producer inserts at once.
+ * @return Seconds from the first fork until the last consumer ended.
+ */
+double runSharedBenchmark(SharedHeap *shared, const char *name, int producers, int consumers, long keys, int batch)
+{
+    SharedHeap own;
+    pid_t processes[2 * MAX_THREADS];
+    uint64_t begin, seed;
+    long done;
+    int *buffer;
+    int i, j, count, key;
+
+    fflush(NULL); /*the children must not write this process's buffered output again*/
+    begin = nowNanoseconds();
+    for (i = 0; i < producers + consumers; i++)
+    {
+        processes[i] = fork();
+        if (processes[i] < 0)
+        {
+            perror("Error creating process");
+            exit(EXIT_FAILURE);
+        }
+        if (processes[i] > 0)
+            continue;
+
+        attachSharedHeap(&own, name);
+        if (i < producers)
+        {
+            buffer = malloc((size_t)batch * sizeof(int));
+            if (!buffer)
+            {
+                fprintf(stderr, "Error: out of memory\n");
+                exit(EXIT_FAILURE);
+            }
+            seed = 0x9E3779B97F4A7C15ULL * (uint64_t)(i + 1);
+            for (done = 0; done < keys / producers; done += count)
+            {
+                count = keys / producers - done < batch ? (int)(keys / producers - done) : batch;
+                for (j = 0; j < count; j++)
+                    buffer[j] = (int)(nextRandom(&seed) >> 33);
+                if (sharedInsert(&own, buffer, count) < count)
+                {
+                    fprintf(stderr, "Error: shared heap is full\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            free(buffer);
+        }
+        else
+            while (sharedExtract(&own, &key, WAIT_FOREVER) > 0)
+                ;
+        detachSharedHeap(&own);
+        exit(EXIT_SUCCESS);
+    }
+
+    for (i = 0; i < producers + consumers; i++)
+    {
+        if (i == producers)
+            closeSharedHeap(shared);
+        waitpid(processes[i], NULL, 0);
+    }
+    return (nowNanoseconds() - begin) / 1e9;
+}
+
+/**
+ * Creates, uses and removes heaps in POSIX shared memory. Any number of local processes can
+ * attach to such a heap by name and insert and extract in place, with no copy and no server
+ * in between; a process-shared robust mutex serializes the operations.
+ * Usage: shm create NAME [-s CAPACITY] [-d D]
+ *        shm insert NAME KEY...
+ *        shm extract NAME [-n COUNT] [-w TIMEOUT_MS]
+ *        shm info NAME
+ *        shm close NAME
+ *        shm remove NAME
+ *        shm bench [-p PRODUCERS] [-c CONSUMERS] [-n KEYS] [-b BATCH] [-d D]
+ * extract prints up to COUNT keys (default 1), waiting up to TIMEOUT_MS milliseconds for each
+ * (default 0, -1 waits forever), and fails if it got fewer. bench runs qbench's workload with
+ * processes instead of threads, on a temporary segment.
+ * @param argc Number of arguments, argv[0] being "shm".
+ * @param argv The arguments.
+ * @return The exit status of the program.
+ */
+int runSharedHeap(int argc, const char *argv[])
+{
+    SharedHeap shared;
+    char benchName[64];
+    const char *command = argc > 1 ? argv[1] : "";
+    const char *name = argc > 2 ? argv[2] : NULL;
+    int capacity = SHARED_HEAP_CAPACITY, d = 2, count = 1;
+    int producers = 2, consumers = 2, batch = 1;
+    long keys = 1000000, timeoutMs = 0;
+    double seconds;
+    const char *end;
+    int *values;
+    int key, i;
+
+    if (strcmp(command, "insert") == 0 && argc > 3)
+    {
+        values = malloc((size_t)(argc - 3) * sizeof(int));
+        if (!values)
+        {
+            fprintf(stderr, "Error: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        for (i = 3; i < argc; i++)
+        {
+            end = argv[i] + strlen(argv[i]);
+            if (parseInt(argv[i], end, &values[i - 3]) != end)
+            {
+                fprintf(stderr, "Error: invalid or out of range key %s\nUsage: shm insert NAME KEY...\n", argv[i]);
+                free(values);
+                return EXIT_FAILURE;
+            }
+        }
+        attachSharedHeap(&shared, name);
+        count = sharedInsert(&shared, values, argc - 3);
+        detachSharedHeap(&shared);
+        free(values);
+        if (count < argc - 3)
+        {
+            fprintf(stderr, "Error: shared heap is full, %d of %d keys inserted\n", count, argc - 3);
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+
+    for (i = strcmp(command, "bench") == 0 ? 2 : 3; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-s") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            capacity = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            d = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc && atol(argv[i + 1]) > 0 && atol(argv[i + 1]) <= INT_MAX)
+            keys = count = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc && atol(argv[i + 1]) >= WAIT_FOREVER)
+            timeoutMs = atol(argv[++i]);
+        else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            producers = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            consumers = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            batch = atoi(argv[++i]);
+        else
+            break;
+    }
+    if (i < argc || (!name && strcmp(command, "bench") != 0) || producers > MAX_THREADS || consumers > MAX_THREADS)
+        command = "";
+
+    if (strcmp(command, "create") == 0)
+        createSharedHeap(name, capacity, d);
+    else if (strcmp(command, "extract") == 0)
+    {
+        attachSharedHeap(&shared, name);
+        for (i = 0; i < count && sharedExtract(&shared, &key, timeoutMs) > 0; i++)
+            printf("%d\n", key);
+        detachSharedHeap(&shared);
+        return i == count ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    else if (strcmp(command, "info") == 0)
+    {
+        attachSharedHeap(&shared, name);
+        lockSharedHeap(&shared);
+        printf("%s: %d of %d keys, d=%d", name, shared.heap.size, shared.heap.capacity, shared.heap.d);
+        if (shared.heap.size > 0)
+            printf(", max %d", shared.heap.array[ROOT]);
+        printf("%s\n", shared.header->closed ? ", closed" : "");
+        printf("%lld inserts, %lld extracts, %d waiting, %d recoveries\n", (long long)shared.header->inserts,
+               (long long)shared.header->extracts, shared.header->waiters, shared.header->recoveries);
+        unlockSharedHeap(&shared);
+        detachSharedHeap(&shared);
+    }
+    else if (strcmp(command, "close") == 0)
+    {
+        attachSharedHeap(&shared, name);
+        closeSharedHeap(&shared);
+        detachSharedHeap(&shared);
+    }
+    else if (strcmp(command, "remove") == 0)
+    {
+        if (shm_unlink(name) != 0)
+        {
+            perror("Error removing shared heap");
+            return EXIT_FAILURE;
+        }
+    }
+    else if (strcmp(command, "bench") == 0)
+    {
+        snprintf(benchName, sizeof(benchName), "/d-ary-heap-bench.%d", (int)getpid());
+        createSharedHeap(benchName, (int)keys, d);
+        attachSharedHeap(&shared, benchName);
+        seconds = runSharedBenchmark(&shared, benchName, producers, consumers, keys, batch);
+        printf("producers,consumers,batch,keys,seconds,mops_per_s,recoveries\n");
+        printf("%d,%d,%d,%lld,%.4f,%.2f,%d\n", producers, consumers, batch, (long long)shared.header->extracts, seconds,
+               (shared.header->inserts + shared.header->extracts) / seconds / 1e6, shared.header->recoveries);
+        count = shared.header->extracts == keys / producers * producers;
+        detachSharedHeap(&shared);
+        shm_unlink(benchName);
+        return count ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    else
+    {
+        fprintf(stderr, "Usage: shm create NAME [-s CAPACITY] [-d D]\n"
+                        "       shm insert NAME KEY...\n"
+                        "       shm extract NAME [-n COUNT] [-w TIMEOUT_MS]\n"
+                        "       shm info NAME\n"
+                        "       shm close NAME\n"
+                        "       shm remove NAME\n"
+                        "       shm bench [-p PRODUCERS] [-c CONSUMERS] [-n KEYS] [-b BATCH] [-d D]\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Generates the keys of a benchmark distribution.
+ * @param keys Where to store the keys.
+ * @param size Number of keys.
+ * @param distribution "random", "sorted" (ascending, every insert sifts to the root),
+ *                     "reversed", "few" (FEW_UNIQUE_KEYS distinct keys) or "file".
+ * @param pool Keys of the "file" distribution, repeated as often as needed.
+ * @param poolSize Number of keys in pool.
+ * @param seed State of the random generator.
+ */
+void fillBenchKeys(int *keys, int size, const char *distribution, const int *pool, int poolSize, uint64_t *seed)
+{
+    int i;
+    for (i = 0; i < size; i++)
+    {
+        if (strcmp(distribution, "sorted") == 0)
+            keys[i] = i;
+        else if (strcmp(distribution, "reversed") == 0)
+            keys[i] = size - i;
+        else if (strcmp(distribution, "few") == 0)
+            keys[i] = (int)(nextRandom(seed) % FEW_UNIQUE_KEYS);
+        else if (strcmp(distribution, "file") == 0)
+            keys[i] = pool[i % poolSize];
+        else
+            keys[i] = (int)(nextRandom(seed) >> 34);
+    }
+}
+
+/**
+ * Reads every key of a heap file in file order, line after line, for the "file" benchmark distribution.
+ * @param fileName The heap file.
+ * @param poolSize Where to store the number of keys.
+ * @return The keys, to be freed by the caller.
+ */
+int *loadKeyPool(const char *fileName, int *poolSize)
+{
+    int numHeaps, i;
+    long total = 0;
+    Heap *heaps = readHeapsFromFile(&numHeaps, fileName, 0); /*in file order, not heap order*/
+    int *pool;
+
+    for (i = 0; i < numHeaps; i++)
+        total += heaps[i].size;
+    if (total == 0 || total > INT_MAX)
+    {
+        fprintf(stderr, "Error: no keys in %s\n", fileName);
+        exit(EXIT_FAILURE);
+    }
+    pool = malloc((size_t)total * sizeof(int));
+    if (!pool)
+    {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0, total = 0; i < numHeaps; i++)
+    {
+        memcpy(pool + total, heaps[i].array, (size_t)heaps[i].size * sizeof(int));
+        total += heaps[i].size;
+        freeHeap(&heaps[i]);
+    }
+    free(heaps);
+    *poolSize = (int)total;
+    return pool;
+}
+
+/**
+ * Opens the hardware counters of the benchmark as one group, so they all count the same code:
+ * CPU cycles, instructions, last level cache misses and branch mispredictions, in user space only.
+ * Counters the machine or its perf_event_paranoid setting does not allow are left out.
+ * @param perf The counters to open.
+ * @return Number of counters opened, 0 if none are available.
+ */
+int openPerfCounters(PerfCounters *perf)
+{
+    static const uint64_t configs[PERF_EVENTS] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+    };
+    struct perf_event_attr attr;
+    int i, leader = -1;
+
+    memset(perf, 0, sizeof(*perf));
+    for (i = 0; i < PERF_EVENTS; i++)
+    {
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = configs[i];
+        attr.disabled = leader < 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+        perf->fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+        perf->slots[i] = perf->fds[i] >= 0 ? perf->opened++ : -1;
+        if (leader < 0 && perf->fds[i] >= 0)
+            leader = perf->fds[i];
+    }
+    return perf->opened;
+}
+
+/**
+ * Sets the totals of the hardware counters back to zero.
+ * @param perf The counters.
+ */
+void resetPerfCounters(PerfCounters *perf)
+{
+    memset(perf->totals, 0, sizeof(perf->totals));
+}
+
+/**
+ * Starts counting, from zero, the events of the code that follows.
+ * @param perf The open counters.
+ */
+void startPerfCounters(PerfCounters *perf)
+{
+    int i;
+    for (i = 0; i < PERF_EVENTS && perf->fds[i] < 0; i++)
+        ;
+    ioctl(perf->fds[i], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(perf->fds[i], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+/**
+ * Stops counting and adds the events since startPerfCounters() to the totals.
+ * @param perf The open counters.
+ */
+void stopPerfCounters(PerfCounters *perf)
+{
+    uint64_t values[PERF_EVENTS + 1]; /*the number of counters, then their counts*/
+    int i;
+
+    for (i = 0; i < PERF_EVENTS && perf->fds[i] < 0; i++)
+        ;
+    ioctl(perf->fds[i], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    if (read(perf->fds[i], values, sizeof(values)) < (ssize_t)((perf->opened + 1) * sizeof(uint64_t)))
+        return;
+    for (i = 0; i < PERF_EVENTS; i++)
+        if (perf->slots[i] >= 0)
+            perf->totals[i] += values[perf->slots[i] + 1];
+}
+
+/**
+ * Closes the hardware counters.
+ * @param perf The counters.
+ */
+void closePerfCounters(PerfCounters *perf)
+{
+    int i;
+    for (i = 0; i < PERF_EVENTS; i++)
+        if (perf->fds[i] >= 0)
+            close(perf->fds[i]);
+    perf->opened = 0;
+}
+
+/**
+ * Prints one benchmark measurement as a CSV or JSON line. Comparisons and swaps are
+ * only known when the program is compiled with -DHEAP_STATS, and hardware events only
+ * when they were counted; otherwise they are left empty.
+ * @param bench The measured case.
+ * @param operation Name of the measured operation.
+ * @param operations Number of operations timed.
+ * @param nanoseconds Time they took.
+ * @param comparisons Key comparisons they made.
+ * @param swaps Keys they swapped.
+ */
+void printBenchResult(const BenchCase *bench, const char *operation, long operations, uint64_t nanoseconds,
+                      long long comparisons, long long swaps)
+{
+    static const char *events[PERF_EVENTS] = {
+        "cycles_per_op", "instructions_per_op", "cache_misses_per_op", "branch_misses_per_op"
+    };
+    char counts[64] = "", hardware[256] = "";
+    size_t used = 0;
+    int i;
+
+    for (i = 0; i < PERF_EVENTS; i++)
+    {
+        if (bench->json)
+            used += (size_t)snprintf(hardware + used, sizeof(hardware) - used, ",\"%s\":", events[i]);
+        else
+            hardware[used++] = ',';
+        if (bench->perf && bench->perf->slots[i] >= 0)
+            used += (size_t)snprintf(hardware + used, sizeof(hardware) - used, "%.2f",
+                                     (double)bench->perf->totals[i] / operations);
+        else if (bench->json)
+            used += (size_t)snprintf(hardware + used, sizeof(hardware) - used, "null");
+        hardware[used] = '\0';
+    }
+#ifdef HEAP_STATS
+    snprintf(counts, sizeof(counts), bench->json ? "%.2f,\"swaps_per_op\":%.2f" : "%.2f,%.2f",
+             (double)comparisons / operations, (double)swaps / operations);
+#else
+    (void)comparisons;
+    (void)swaps;
+    strcpy(counts, bench->json ? "null,\"swaps_per_op\":null" : ",");
+#endif
+    if (bench->json)
+        printf("{\"distribution\":\"%s\",\"d\":%d,\"size\":%d,\"operation\":\"%s\",\"ops\":%ld,"
+               "\"ns_per_op\":%.2f,\"comparisons_per_op\":%s%s}\n",
+               bench->distribution, bench->d, bench->size, operation, operations,
+               (double)nanoseconds / operations, counts, hardware);
+    else
+        printf("%s,%d,%d,%s,%ld,%.2f,%s%s\n", bench->distribution, bench->d, bench->size, operation,
+               operations, (double)nanoseconds / operations, counts, hardware);
+    fflush(stdout);
+}
+
+/**
+ * Times every heap operation on a heap of one size, degree and key distribution.
+ * Build and insert start from the keys in distribution order, insert growing an empty heap
+ * to the full size. The other operations restore the heap from a built copy, untimed, and
+ * time at most size/2 operations, so the heap stays between half and all of its size.
+ * Rounds are repeated until BENCH_OPERATIONS operations were timed. Indexes and increments
+ * are drawn before the clock starts. Hardware counters, when given, count the timed code only.
+ * @param bench The case to measure.
+ */
+void runBenchCase(const BenchCase *bench)
+{
+    static const char *operations[] = { "build", "insert", "extract", "increase", "delete" };
+    int perRound = bench->size / 2 > 0 ? bench->size / 2 : 1;
+    int *built = malloc((size_t)bench->size * sizeof(int));
+    int *operands = malloc((size_t)perRound * sizeof(int));
+    int *increments = malloc((size_t)perRound * sizeof(int));
+    uint64_t seed = bench->seed, elapsed, begin;
+    long long comparisons = 0, swaps = 0;
+    long timed;
+    Heap heap;
+    int op, count, i;
+
+    if (!built || !operands || !increments)
+    {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    initHeap(&heap, bench->size, bench->d);
+    memcpy(heap.array, bench->keys, (size_t)bench->size * sizeof(int));
+    heap.size = bench->size;
+    buildMaxHeap(&heap);
+    memcpy(built, heap.array, (size_t)bench->size * sizeof(int));
+
+    for (op = 0; op < (int)(sizeof(operations) / sizeof(operations[0])); op++)
+    {
+        elapsed = 0;
+        timed = 0;
+        resetHeapStats(&heap);
+        if (bench->perf)
+            resetPerfCounters(bench->perf);
+        while (timed < BENCH_OPERATIONS)
+        {
+            count = op <= 1 ? bench->size : perRound;
+            memcpy(heap.array, op == 0 ? bench->keys : built, (size_t)bench->size * sizeof(int));
+            heap.size = op == 1 ? 0 : bench->size;
+            for (i = 0; i < perRound; i++)
+            {
+                operands[i] = (int)(nextRandom(&seed) % (uint64_t)(bench->size - (op == 4 ? i : 0)));
+                increments[i] = (int)(nextRandom(&seed) % 1024) + 1;
+            }
+
+            if (bench->perf)
+                startPerfCounters(bench->perf);
+            begin = nowNanoseconds();
+            switch (op)
+            {
+            case 0:
+                buildMaxHeap(&heap);
+                break;
+            case 1:
+                for (i = 0; i < count; i++)
+                    insert(&heap, bench->keys[i]);
+                break;
+            case 2:
+                for (i = 0; i < count; i++)
+                    heapExtractMax(&heap);
+                break;
+            case 3:
+                for (i = 0; i < count; i++)
+                    if (heap.array[operands[i]] <= INT_MAX - increments[i])
+                        increaseKey(&heap, operands[i], heap.array[operands[i]] + increments[i]);
+                break;
+            default:
+                for (i = 0; i < count; i++)
+                    delete(&heap, operands[i]);
+                break;
+            }
+            elapsed += nowNanoseconds() - begin;
+            if (bench->perf)
+                stopPerfCounters(bench->perf);
+            timed += count;
+        }
+#ifdef HEAP_STATS
+        comparisons = heap.stats.comparisons;
+        swaps = heap.stats.siftUpLevels + heap.stats.siftDownLevels;
+#endif
+        printBenchResult(bench, operations[op], timed, elapsed, comparisons, swaps);
+    }
+
+    freeHeap(&heap);
+    free(built);
+    free(operands);
+    free(increments);
+}
+
+/**
+ * Times insert, extract, increase-key, delete and build for every combination of degree,
+ * heap size and key distribution. Sizes grow tenfold from 100 up to the maximum. Build is
+ * reported per key. Prints CSV, or JSON lines with -j. With -p the hardware counters of
+ * openPerfCounters() are read around the timed code too; the columns of counters that cannot
+ * be opened stay empty.
+ * Usage: bench [-d D]... [-n MAX_SIZE] [-k DISTRIBUTION]... [-f FILE] [-j] [-p]
+ * @param argc Number of arguments, argv[0] being "bench".
+ * @param argv The arguments.
+ * @return The exit status of the program.
+ */
+int runHeapBenchmark(int argc, const char *argv[])
 {
-    char input[100];
-    int number;
-    while (1) 
+    static const int defaultDegrees[] = { 2, 3, 4, 8, 16, 32, 64 };
+    static const char *defaultDistributions[] = { "random", "sorted", "reversed", "few" };
+    const char *distributions[16];
+    int degrees[16];
+    int numDegrees = 0, numDistributions = 0, maxSize = 1000000, json = 0, poolSize = 0, hardware = 0;
+    const char *poolFile = NULL;
+    PerfCounters perf;
+    int *pool = NULL, *keys;
+    uint64_t seed = 88172645463325252ULL;
+    BenchCase bench;
+    long size;
+    int i, j;
+
+    for (i = 1; i < argc; i++)
     {
-        printf("%s", prompt);
-        scanf("%s", input);
+        if (strcmp(argv[i], "-d") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 1 && numDegrees < 16)
+            degrees[numDegrees++] = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc && atoi(argv[i + 1]) >= 100)
+            maxSize = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc && numDistributions < 16
+                 && (strcmp(argv[i + 1], "random") == 0 || strcmp(argv[i + 1], "sorted") == 0
+                     || strcmp(argv[i + 1], "reversed") == 0 || strcmp(argv[i + 1], "few") == 0
+                     || strcmp(argv[i + 1], "file") == 0))
+            distributions[numDistributions++] = argv[++i];
+        else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+            poolFile = argv[++i];
+        else if (strcmp(argv[i], "-j") == 0)
+            json = 1;
+        else if (strcmp(argv[i], "-p") == 0)
+            hardware = 1;
+        else
+            break;
+    }
+    if (i < argc)
+    {
+        fprintf(stderr, "Usage: bench [-d D]... [-n MAX_SIZE] [-k random|sorted|reversed|few|file]... [-f FILE] [-j] [-p]\n");
+        return EXIT_FAILURE;
+    }
+    if (numDegrees == 0)
+        for (i = 0; i < (int)(sizeof(defaultDegrees) / sizeof(defaultDegrees[0])); i++)
+            degrees[numDegrees++] = defaultDegrees[i];
+    if (numDistributions == 0)
+    {
+        for (i = 0; i < (int)(sizeof(defaultDistributions) / sizeof(defaultDistributions[0])); i++)
+            distributions[numDistributions++] = defaultDistributions[i];
+        if (poolFile)
+            distributions[numDistributions++] = "file";
+    }
+    for (i = 0; i < numDistributions; i++)
+        if (strcmp(distributions[i], "file") == 0 && !pool)
+            pool = loadKeyPool(poolFile ? poolFile : "heap_examples.txt", &poolSize);
 
-        if (isNumber(input))
+    if (hardware && !openPerfCounters(&perf))
+    {
+        fprintf(stderr, "Warning: hardware counters are not available (%s), their columns stay empty\n",
+                strerror(errno));
+        hardware = 0;
+    }
+
+    keys = malloc((size_t)maxSize * sizeof(int));
+    if (!keys)
+    {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    if (!json)
+        printf("distribution,d,size,operation,ops,ns_per_op,comparisons_per_op,swaps_per_op,"
+               "cycles_per_op,instructions_per_op,cache_misses_per_op,branch_misses_per_op\n");
+    for (i = 0; i < numDistributions; i++)
+        for (size = 100; size <= maxSize; size *= 10)
         {
-            number = atoi(input);
-            if (number >= min && number <= max)
-                return number;
+            fillBenchKeys(keys, (int)size, distributions[i], pool, poolSize, &seed);
+            for (j = 0; j < numDegrees; j++)
+            {
+                bench.distribution = distributions[i];
+                bench.d = degrees[j];
+                bench.size = (int)size;
+                bench.keys = keys;
+                bench.json = json;
+                bench.seed = seed + (uint64_t)j;
+                bench.perf = hardware ? &perf : NULL;
+                runBenchCase(&bench);
+            }
         }
-        printf("Invalid input. Please enter a number between %d and %d.\n", min, max);
+
+    if (hardware)
+        closePerfCounters(&perf);
+    free(keys);
+    free(pool);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Changes the degree of a heap and rebuilds it in place in O(n).
+ * @param heap The heap.
+ * @param d The new degree.
+ */
+void rebuildHeap(Heap *heap, int d)
+{
+    heap->d = d;
+    buildMaxHeap(heap);
+    if (heap->size > 0)
+        markChanged(heap, ROOT, heap->size - 1);
+}
+
+/**
+ * Counts the levels of a heap.
+ * @param size Number of keys.
+ * @param d The degree of the heap.
+ * @return Number of levels, at least 1.
+ */
+int heapLevels(long size, int d)
+{
+    long width = 1, total = 1;
+    int levels = 1;
+
+    while (total < size)
+    {
+        width *= d;
+        total += width;
+        levels++;
+    }
+    return levels;
+}
+
+/**
+ * Picks the degree that suits an operation mix best. Moving a key up costs one comparison
+ * per level and moving it down d per level, so the cost of the mix is taken as
+ * (up + d * down) * levels. The current degree is kept unless another one costs less than
+ * ADAPT_GAIN of it, so a mix near the boundary does not rebuild every time.
+ * @param up Operations that move keys up: inserts, increases and deletes.
+ * @param down Operations that move keys down: extracts and deletes.
+ * @param size Number of keys in the heap.
+ * @param current The degree in use, or 0 for just the cheapest degree.
+ * @return The degree to use.
+ */
+int chooseDegree(long up, long down, long size, int current)
+{
+    static const int candidates[] = { 2, 3, 4, 6, 8, 12, 16, 32, 64 };
+    double cost, best = 0;
+    int choice = current, i;
+
+    for (i = 0; i < (int)(sizeof(candidates) / sizeof(candidates[0])); i++)
+    {
+        cost = (up + (double)candidates[i] * down) * heapLevels(size, candidates[i]);
+        if (i == 0 || cost < best)
+        {
+            best = cost;
+            choice = candidates[i];
+        }
+    }
+    if (current < 1)
+        return choice;
+    cost = (up + (double)current * down) * heapLevels(size, current);
+    return best < ADAPT_GAIN * cost ? choice : current;
+}
+
+/**
+ * Parses an operations script, in the format of batch mode, into an array of operations.
+ * Print lines are dropped.
+ * @param data The script.
+ * @param length Length of the script in bytes.
+ * @param ops Where to store the array, to be freed by the caller.
+ * @return Number of operations.
+ */
+long parseScript(const char *data, size_t length, ScriptOp **ops)
+{
+    const char *p = data, *end = data + length, *lineEnd, *q;
+    long count = 0, capacity = 1024, lineNumber = 0;
+    ScriptOp op;
+
+    *ops = malloc((size_t)capacity * sizeof(ScriptOp));
+    while (*ops && p < end)
+    {
+        lineEnd = memchr(p, '\n', (size_t)(end - p));
+        if (!lineEnd)
+            lineEnd = end;
+        lineNumber++;
+        q = skipBlanks(p, lineEnd);
+        p = lineEnd < end ? lineEnd + 1 : end;
+        if (q == lineEnd || *q == '#' || *q == 'p')
+            continue;
+
+        op.op = *q++;
+        op.index = op.key = 0;
+        if (op.op == 'k' || op.op == 'd')
+            q = parseInt(skipBlanks(q, lineEnd), lineEnd, &op.index);
+        if (q && (op.op == 'i' || op.op == 'k'))
+            q = parseInt(skipBlanks(q, lineEnd), lineEnd, &op.key);
+        if (!q || skipBlanks(q, lineEnd) != lineEnd || op.op == '\0' || !strchr("ixkd", op.op) || op.index < 0)
+        {
+            fprintf(stderr, "Error: invalid operation on line %ld\n", lineNumber);
+            exit(EXIT_FAILURE);
+        }
+
+        if (count == capacity)
+        {
+            capacity *= 2;
+            *ops = realloc(*ops, (size_t)capacity * sizeof(ScriptOp));
+            if (!*ops)
+                break;
+        }
+        (*ops)[count++] = op;
+    }
+    if (!*ops)
+    {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return count;
+}
+
+/**
+ * Replays parsed operations on a heap. Indexes in a script depend on the degree it was
+ * recorded with, so operations that make no sense for this heap are skipped instead of
+ * failing: extracts from an empty heap, indexes past the end and increases to a smaller key.
+ * @param heap The heap.
+ * @param ops The operations.
+ * @param count Number of operations.
+ * @param pool Keys of the 'm' operations of a trace, see readTrace(), NULL for a script.
+ * @param latency Histograms to record sampled latencies in, or NULL not to time operations.
+ * @return Number of operations skipped.
+ */
+long replayScript(Heap *heap, const ScriptOp *ops, long count, const int *pool, LatencyRecorder *latency)
+{
+    uint64_t begin = 0;
+    long skipped = 0, i;
+    int timed;
+
+    for (i = 0; i < count; i++)
+    {
+        timed = sampleLatency(latency, ops[i].op);
+        if (timed >= 0)
+            begin = nowNanoseconds();
+        switch (ops[i].op)
+        {
+            case 'i':
+                insert(heap, ops[i].key);
+                break;
+            case 'x':
+                if (heap->size > 0)
+                    heapExtractMax(heap);
+                else
+                    skipped++;
+                break;
+            case 'k':
+                if (ops[i].index >= 0 && ops[i].index < heap->size && ops[i].key >= heap->array[ops[i].index])
+                    increaseKey(heap, ops[i].index, ops[i].key);
+                else
+                    skipped++;
+                break;
+            case 'd':
+                if (ops[i].index >= 0 && ops[i].index < heap->size)
+                    delete(heap, ops[i].index);
+                else
+                    skipped++;
+                break;
+            default:
+                insertMany(heap, pool + ops[i].index, ops[i].key);
+                break;
+        }
+        if (timed >= 0)
+            recordLatency(&latency->histograms[timed], nowNanoseconds() - begin);
+    }
+    return skipped;
+}
+
+/**
+ * Replays parsed operations on a concurrent priority queue, from a single thread. The queues
+ * have no indexes, so increase-key and delete are skipped, as are extracts that find no key.
+ * @param engine The implementation of the queue.
+ * @param queue The queue.
+ * @param ops The operations.
+ * @param count Number of operations.
+ * @param pool Keys of the 'm' operations of a trace, see readTrace(), NULL for a script.
+ * @param latency Histograms to record sampled latencies in, or NULL not to time operations.
+ * @return Number of operations skipped.
+ */
+long replayOnEngine(const ConcurrentEngine *engine, void *queue, const ScriptOp *ops, long count, const int *pool,
+                    LatencyRecorder *latency)
+{
+    uint64_t begin = 0;
+    long skipped = 0, i;
+    int timed, key, j;
+
+    for (i = 0; i < count; i++)
+    {
+        timed = sampleLatency(latency, ops[i].op);
+        if (timed >= 0)
+            begin = nowNanoseconds();
+        switch (ops[i].op)
+        {
+            case 'i':
+                engine->insert(queue, 0, ops[i].key);
+                break;
+            case 'x':
+                if (!engine->extract(queue, 0, &key))
+                    skipped++;
+                break;
+            case 'm':
+                for (j = 0; j < ops[i].key; j++)
+                    engine->insert(queue, 0, pool[ops[i].index + j]);
+                break;
+            default:
+                skipped++;
+                break;
+        }
+        if (timed >= 0)
+            recordLatency(&latency->histograms[timed], nowNanoseconds() - begin);
+    }
+    return skipped;
+}
+
+/**
+ * Replays a recorded operations script against several degrees and recommends the fastest.
+ * The script is parsed once; every degree builds its heap untimed from the same keys, taken
+ * in file order as batch loads them, and its best time over the iterations counts. One CSV
+ * line is printed per degree.
+ * The indexes of increase-key and delete refer to the layout the script was recorded with,
+ * so other degrees may skip them; such a degree ran less work and is only recommended if
+ * every degree skipped as much.
+ * Instead of FILE and SCRIPT, an operation trace may be given: it holds its starting keys.
+ * Usage: tune [-d D]... [-h N] [-r] [-i ITERATIONS] FILE SCRIPT | TRACE
+ * @param argc Number of arguments, argv[0] being "tune".
+ * @param argv The arguments.
+ * @return The exit status of the program.
+ */
+int runTuner(int argc, const char *argv[])
+{
+    static const int defaultDegrees[] = { 2, 3, 4, 6, 8, 12, 16, 32, 64 };
+    static const char kinds[] = LATENCY_OPS; /*the order of mix*/
+    const char *fileName = NULL, *scriptName = NULL;
+    int degrees[16];
+    int numDegrees = 0, heapNumber = 1, isRaw = 0, iterations = 3;
+    int best = 0, initialSize, iteration, i;
+    long count, mix[4] = { 0, 0, 0, 0 }, skipped = 0, bestSkipped = 0;
+    uint64_t elapsed, fastest, bestTime = 0;
+    const char *kind;
+    InputFile script;
+    ScriptOp *ops;
+    Heap heap;
+    int *keys, *pool = NULL;
+    int traceD;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-d") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 1 && numDegrees < 16)
+            degrees[numDegrees++] = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-h") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            heapNumber = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-r") == 0)
+            isRaw = 1;
+        else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            iterations = atoi(argv[++i]);
+        else if (argv[i][0] != '-' && !fileName)
+            fileName = argv[i];
+        else if (argv[i][0] != '-' && !scriptName)
+            scriptName = argv[i];
+        else
+            break;
+    }
+    if (!scriptName)
+    {
+        scriptName = fileName;
+        fileName = NULL;
+    }
+    if (scriptName)
+        mapInputFile(&script, scriptName);
+    if (i < argc || !scriptName || (fileName == NULL) != isTrace(script.data, script.length))
+    {
+        fprintf(stderr, "Usage: tune [-d D]... [-h N] [-r] [-i ITERATIONS] FILE SCRIPT | TRACE\n");
+        return EXIT_FAILURE;
+    }
+    if (numDegrees == 0)
+        for (i = 0; i < (int)(sizeof(defaultDegrees) / sizeof(defaultDegrees[0])); i++)
+            degrees[numDegrees++] = defaultDegrees[i];
+
+    if (!fileName)
+    {
+        /*a trace starts with its own keys, at the head of the pool*/
+        count = readTrace(script.data, script.length, &ops, &pool, &initialSize, &traceD);
+        keys = pool;
+    }
+    else
+    {
+        /*keep a private copy of the starting keys in file order, each degree builds its own layout*/
+        loadHeap(&heap, fileName, heapNumber, 0, isRaw);
+        initialSize = heap.size;
+        keys = malloc(((size_t)initialSize + 1) * sizeof(int));
+        if (!keys)
+        {
+            fprintf(stderr, "Error: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(keys, heap.array, (size_t)initialSize * sizeof(int));
+        freeHeap(&heap);
+        count = parseScript(script.data, script.length, &ops);
+    }
+    unmapInputFile(&script);
+    for (i = 0; i < count; i++)
+    {
+        kind = ops[i].op != '\0' ? strchr(kinds, ops[i].op) : NULL;
+        if (ops[i].op == 'm')
+            mix[0] += ops[i].key;
+        else if (kind && kind - kinds < 4)
+            mix[kind - kinds]++;
+    }
+    printf("# %d keys, %ld operations: %ld inserts, %ld extracts, %ld increases, %ld deletes\n",
+           initialSize, count, mix[0], mix[1], mix[2], mix[3]);
+    printf("d,ns_per_op,skipped\n");
+
+    for (i = 0; i < numDegrees; i++)
+    {
+        fastest = 0;
+        for (iteration = 0; iteration < iterations; iteration++)
+        {
+            initHeap(&heap, initialSize, degrees[i]);
+            memcpy(heap.array, keys, (size_t)initialSize * sizeof(int));
+            heap.size = initialSize;
+            buildMaxHeap(&heap);
+
+            elapsed = nowNanoseconds();
+            skipped = replayScript(&heap, ops, count, pool, NULL);
+            elapsed = nowNanoseconds() - elapsed;
+            if (iteration == 0 || elapsed < fastest)
+                fastest = elapsed;
+            freeHeap(&heap);
+        }
+        printf("%d,%.2f,%ld\n", degrees[i], count ? (double)fastest / count : 0.0, skipped);
+        fflush(stdout);
+        if (i == 0 || skipped < bestSkipped || (skipped == bestSkipped && fastest < bestTime))
+        {
+            bestTime = fastest;
+            bestSkipped = skipped;
+            best = degrees[i];
+        }
+    }
+    if (bestSkipped > 0)
+        printf("# every degree skipped operations, the script's indexes belong to another degree\n");
+    printf("# recommended d=%d (the operation mix model suggests d=%d)\n", best,
+           chooseDegree(mix[0] + mix[2] + mix[3], mix[1] + mix[3], initialSize, 0));
+
+    free(ops);
+    free(keys);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Runs an operation trace, as fast as it goes, against the sequential heap and the concurrent
+ * priority queues at several degrees, to benchmark recorded behaviour offline. Every run starts
+ * from the starting keys of the trace, loaded untimed, and the best time over the iterations
+ * counts. One CSV line is printed per engine and degree, with latency percentiles under -l.
+ * Only the heap at the recorded degree replays the whole trace; other runs skip operations
+ * whose indexes do not fit, and a warning says so.
+ * Usage: replay [-e ENGINE]... [-d D]... [-i ITERATIONS] [-l SAMPLE] TRACE
+ * ENGINE is "heap" for the sequential heap (the default) or one of the engines of cbench,
+ * driven from one thread; the default degree is the one the trace was recorded with.
+ * @param argc Number of arguments, argv[0] being "replay".
+ * @param argv The arguments.
+ * @return The exit status of the program.
+ */
+int runReplay(int argc, const char *argv[])
+{
+    const char *names[16], *traceName = NULL;
+    const ConcurrentEngine *engine;
+    int degrees[16];
+    int numNames = 0, numDegrees = 0, iterations = 3, sampleEvery = 0;
+    int numInitial, traceD, iteration, i, j, k;
+    long count, skipped = 0;
+    uint64_t elapsed, fastest;
+    LatencyRecorder *latency = NULL;
+    LatencyHistogram all;
+    InputFile trace;
+    ScriptOp *ops;
+    int *pool;
+    void *queue;
+    Heap heap;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-e") == 0 && i + 1 < argc && numNames < 16
+            && (strcmp(argv[i + 1], "heap") == 0 || findEngine(argv[i + 1])))
+            names[numNames++] = argv[++i];
+        else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 1 && numDegrees < 16)
+            degrees[numDegrees++] = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            iterations = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            sampleEvery = atoi(argv[++i]);
+        else if (argv[i][0] != '-' && !traceName)
+            traceName = argv[i];
+        else
+            break;
+    }
+    if (traceName)
+        mapInputFile(&trace, traceName);
+    if (i < argc || !traceName || !isTrace(trace.data, trace.length))
+    {
+        fprintf(stderr, "Usage: replay [-e heap|lock|fc|hunt|mq|steal|ring]... [-d D]... [-i ITERATIONS] [-l SAMPLE] TRACE\n");
+        return EXIT_FAILURE;
+    }
+    count = readTrace(trace.data, trace.length, &ops, &pool, &numInitial, &traceD);
+    unmapInputFile(&trace);
+    if (numNames == 0)
+        names[numNames++] = "heap";
+    if (numDegrees == 0)
+        degrees[numDegrees++] = traceD;
+    if (sampleEvery)
+    {
+        latency = malloc(sizeof(*latency));
+        if (!latency)
+        {
+            fprintf(stderr, "Error: out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    printf("# %d starting keys, %ld operations, recorded with d=%d\n", numInitial, count, traceD);
+    printf("engine,d,ops,ns_per_op,mops_per_s,skipped,p50_ns,p99_ns,p999_ns,max_ns\n");
+    for (i = 0; i < numNames; i++)
+        for (j = 0; j < numDegrees; j++)
+        {
+            engine = strcmp(names[i], "heap") == 0 ? NULL : findEngine(names[i]);
+            fastest = 0;
+            if (latency)
+                initLatencyRecorder(latency, sampleEvery);
+            for (iteration = 0; iteration < iterations; iteration++)
+            {
+                if (!engine)
+                {
+                    initHeap(&heap, numInitial, degrees[j]);
+                    memcpy(heap.array, pool, (size_t)numInitial * sizeof(int));
+                    heap.size = numInitial;
+                    buildMaxHeap(&heap);
+                    elapsed = nowNanoseconds();
+                    skipped = replayScript(&heap, ops, count, pool, latency);
+                    elapsed = nowNanoseconds() - elapsed;
+                    freeHeap(&heap);
+                }
+                else
+                {
+                    queue = engine->create(degrees[j], 1);
+                    for (k = 0; k < numInitial; k++)
+                        engine->insert(queue, 0, pool[k]);
+                    elapsed = nowNanoseconds();
+                    skipped = replayOnEngine(engine, queue, ops, count, pool, latency);
+                    elapsed = nowNanoseconds() - elapsed;
+                    engine->destroy(queue);
+                }
+                if (iteration == 0 || elapsed < fastest)
+                    fastest = elapsed;
+            }
+
+            printf("%s,%d,%ld,%.2f,%.2f,%ld", names[i], degrees[j], count,
+                   count ? (double)fastest / count : 0.0, fastest ? count * 1e3 / (double)fastest : 0.0, skipped);
+            if (latency)
+            {
+                mergeLatencies(latency, &all);
+                printf(",%llu,%llu,%llu,%llu\n", (unsigned long long)latencyPercentile(&all, 0.5),
+                       (unsigned long long)latencyPercentile(&all, 0.99),
+                       (unsigned long long)latencyPercentile(&all, 0.999), (unsigned long long)all.max);
+            }
+            else
+                printf(",,,,\n");
+            fflush(stdout);
+            if (skipped > 0)
+                fprintf(stderr, "Warning: %s at d=%d skipped %ld of %ld operations, it ran less than the recorded work\n",
+                        names[i], degrees[j], skipped, count);
+        }
+
+    free(latency);
+    free(ops);
+    free(pool);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Draws a heap index with a power-law skew towards the root: u^skew * size for u uniform in
+ * [0, 1). The density falls like x^(1/skew - 1), a Zipf-like law with exponent 1 - 1/skew;
+ * skew 1 is uniform, and about 100 matches the usual Zipf exponent of 0.99.
+ * @param seed State of the random generator.
+ * @param size Number of keys in the heap, at least 1.
+ * @param skew The skew, at least 1.
+ * @return An index below size.
+ */
+int skewedIndex(uint64_t *seed, int size, int skew)
+{
+    double u = (double)(nextRandom(seed) >> 11) / (double)(1ULL << 53), p = u;
+    int i;
+
+    for (i = 1; i < skew; i++)
+        p *= u;
+    return (int)(p * size);
+}
+
+/**
+ * Draws a new key for the workload generator.
+ * Uniform keys are spread over [0, GEN_KEY_RANGE). Hold and monotone keys fall below the last
+ * extracted key by at most increment, like the event times of a simulation or the distances
+ * of Dijkstra's algorithm, mirrored for a max-heap.
+ * @param seed State of the random generator.
+ * @param model "uniform", "hold" or "monotone".
+ * @param last Last extracted key, or the largest starting key before the first extract.
+ * @param increment Largest step below the last extracted key.
+ * @return The key.
+ */
+int generateKey(uint64_t *seed, const char *model, int last, int increment)
+{
+    int step;
+    if (strcmp(model, "uniform") == 0)
+        return (int)(nextRandom(seed) % GEN_KEY_RANGE);
+    step = (int)(nextRandom(seed) % (uint64_t)increment);
+    return last < INT_MIN + step ? INT_MIN : last - step;
+}
+
+/**
+ * Generates a synthetic workload as a batch script on standard output, or as a trace with -t.
+ * The operations run on a heap of degree D while they are generated, so every index is
+ * valid for a heap of that degree built from the same keys in the same order, which -o writes
+ * as a raw key file: batch -r -d D and tune -r load them that way, and a trace holds them.
+ * Usage: gen [-n OPERATIONS] [-s SIZE] [-d D] [-m I:X:K:D] [-k uniform|hold|monotone]
+ *            [-i INCREMENT] [-b BURST] [-z SKEW] [-r SEED] [-o KEYS] [-t TRACE]
+ * -m gives the weights of insert, extract, increase-key and delete (default 50:50:0:0). The key
+ * models are described at generateKey(); hold ignores -m and pairs every extract with an insert.
+ * Inserts arrive BURST at a time, and increases and deletes pick their index with skewedIndex().
+ * @param argc Number of arguments, argv[0] being "gen".
+ * @param argv The arguments.
+ * @return The exit status of the program.
+ */
+int runGenerator(int argc, const char *argv[])
+{
+    const char *model = "uniform", *keysName = NULL, *traceName = NULL;
+    long operations = 1000000, generated = 0, counts[4] = { 0, 0, 0, 0 };
+    int size = 1000, d = 2, increment = 1000, burst = 1, skew = 1;
+    int weights[4] = { 50, 50, 0, 0 };
+    uint64_t seed = 88172645463325252ULL, pick;
+    long total;
+    int last, key, index, op, i;
+    Heap heap;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc && atol(argv[i + 1]) > 0)
+            operations = atol(argv[++i]);
+        else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc && atoi(argv[i + 1]) >= 0)
+            size = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 1)
+            d = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc
+                 && sscanf(argv[i + 1], "%d:%d:%d:%d", &weights[0], &weights[1], &weights[2], &weights[3]) == 4
+                 && weights[0] > 0 && weights[1] >= 0 && weights[2] >= 0 && weights[3] >= 0)
+            i++;
+        else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc
+                 && (strcmp(argv[i + 1], "uniform") == 0 || strcmp(argv[i + 1], "hold") == 0
+                     || strcmp(argv[i + 1], "monotone") == 0))
+            model = argv[++i];
+        else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            increment = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            burst = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-z") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            skew = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+            seed = strtoull(argv[++i], NULL, 10) | 1;
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            keysName = argv[++i];
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+            traceName = argv[++i];
+        else
+            break;
+    }
+    if (i < argc)
+    {
+        fprintf(stderr, "Usage: gen [-n OPERATIONS] [-s SIZE] [-d D] [-m I:X:K:D] [-k uniform|hold|monotone]\n"
+                        "           [-i INCREMENT] [-b BURST] [-z SKEW] [-r SEED] [-o KEYS] [-t TRACE]\n");
+        return EXIT_FAILURE;
     }
+
+    /*the starting keys*/
+    initHeap(&heap, size, d);
+    for (i = 0; i < size; i++)
+        heap.array[i] = generateKey(&seed, model, GEN_KEY_BASE, increment);
+    heap.size = size;
+    buildMaxHeap(&heap);
+    last = size > 0 ? heap.array[ROOT] : GEN_KEY_BASE;
+    if (keysName)
+        dumpHeapKeys(&heap, keysName);
+    if (traceName)
+        startTrace(&heap, traceName);
+
+    /*inserts are drawn 1/burst as often, since each one brings burst keys*/
+    while (generated < operations)
+    {
+        if (strcmp(model, "hold") == 0)
+            op = heap.size > 0 && heap.size >= size ? 1 : 0; /*keep the size around its start*/
+        else
+        {
+            total = weights[0] + (long)burst * (heap.size > 0 ? weights[1] + weights[2] + weights[3] : 0);
+            pick = nextRandom(&seed) % (uint64_t)total;
+            for (op = 0; op < 3 && (long)pick >= (op == 0 ? weights[0] : (long)burst * weights[op]); op++)
+                pick -= op == 0 ? weights[0] : (long)burst * weights[op];
+        }
+
+        switch (op)
+        {
+            case 0:
+                for (i = 0; i < (strcmp(model, "hold") == 0 ? 1 : burst) && generated < operations; i++, generated++)
+                {
+                    key = generateKey(&seed, model, last, increment);
+                    insert(&heap, key);
+                    if (!traceName)
+                        printf("i %d\n", key);
+                    counts[0]++;
+                }
+                break;
+            case 1:
+                last = heapExtractMax(&heap);
+                if (!traceName)
+                    printf("x\n");
+                counts[1]++;
+                generated++;
+                break;
+            case 2:
+                /*a monotone key may rise up to the last extracted key, a uniform one by up to increment*/
+                index = skewedIndex(&seed, heap.size, skew);
+                key = heap.array[index];
+                if (strcmp(model, "monotone") == 0)
+                    key += (int)(nextRandom(&seed) % ((uint64_t)((int64_t)last - key) + 1));
+                else
+                    key = key > INT_MAX - 1 - increment ? INT_MAX - 1 : key + 1 + (int)(nextRandom(&seed) % (uint64_t)increment);
+                increaseKey(&heap, index, key);
+                if (!traceName)
+                    printf("k %d %d\n", index, key);
+                counts[2]++;
+                generated++;
+                break;
+            default:
+                index = skewedIndex(&seed, heap.size, skew);
+                delete(&heap, index);
+                if (!traceName)
+                    printf("d %d\n", index);
+                counts[3]++;
+                generated++;
+                break;
+        }
+    }
+
+    fprintf(stderr, "Generated %ld operations: %ld inserts, %ld extracts, %ld increases, %ld deletes, final size %d\n",
+            generated, counts[0], counts[1], counts[2], counts[3], heap.size);
+    freeHeap(&heap);
+    if (fflush(stdout) != 0)
+    {
+        perror("Error writing workload");
+        exit(EXIT_FAILURE);
+    }
+    return EXIT_SUCCESS;
 }
 
 /**
@@ -317,45 +7408,144 @@ int getIntInput(const char *prompt, int min, int max)
 int main(int argc, const char * argv[])
 {
     Heap *selectedHeap;
-    Heap heaps[MAX_HEAPS];
-    int numHeaps;
+    Heap fileHeap;
+    HeapIndex heapIndex;
+    int isBinary, isRaw;
+    int printTop, printChanged;
     int selectedHeapIndex;
     int key, index,choice;
     int d;
     char fileName[MAX_FILENAME_LENGTH];
     int i;
+
+    /*non-interactive modes*/
+    if (argc > 1 && strcmp(argv[1], "batch") == 0)
+        return runBatch(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "pipe") == 0)
+        return runPipe(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "serve") == 0)
+        return runServer(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "loadgen") == 0)
+        return runLoadGenerator(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "cbench") == 0)
+        return runConcurrentBenchmark(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "stress") == 0)
+        return runStressTest(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "qbench") == 0)
+        return runBlockingBenchmark(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "bench") == 0)
+        return runHeapBenchmark(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "tune") == 0)
+        return runTuner(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "replay") == 0)
+        return runReplay(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "gen") == 0)
+        return runGenerator(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "shm") == 0)
+        return runSharedHeap(argc - 1, argv + 1);
+
+    /*read options, -r FILE opens a file of raw int32 keys, -t N prints only the top N keys
+      after each operation and -c prints only the keys the operation changed*/
+    isRaw = 0;
+    printTop = 0;
+    printChanged = 0;
+    fileName[0] = '\0';
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-r") == 0)
+            isRaw = 1;
+        else if (strcmp(argv[i], "-c") == 0)
+            printChanged = 1;
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            printTop = atoi(argv[++i]);
+        else if (argv[i][0] != '-' && !fileName[0])
+            snprintf(fileName, sizeof(fileName), "%s", argv[i]);
+        else
+            break;
+    }
+    if (i < argc || (isRaw && !fileName[0]))
+    {
+        fprintf(stderr, "Usage: %s [-r] [-t N] [-c] [file]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
     /*read file*/
-    printf("Enter the name of the file containing heap data: ");
-    scanf("%s", fileName);
-    readHeapsFromFile(heaps, &numHeaps, fileName);
-    
-    
-    /*print arrays*/
-    printf("Available arrays:\n");
-    for (i = 0; i < numHeaps; i++)
+    if (!fileName[0])
+    {
+        printf("Enter the name of the file containing heap data: ");
+        scanf("%s", fileName);
+    }
+
+    isBinary = isRaw || isHeapFile(fileName);
+    if (isRaw)
+    {
+        /*raw keys are heapified right in the mapped file*/
+        d = getIntInput("Enter the degree (d) of the heap (greater than 1): ", 1, INT_MAX);
+        openRawKeyFile(&fileHeap, fileName, d);
+        selectedHeap = &fileHeap;
+    }
+    else if (isBinary)
+    {
+        /*binary heap files are used in place, the degree is stored in the file*/
+        openHeapFile(&fileHeap, fileName, 0);
+        selectedHeap = &fileHeap;
+        d = selectedHeap->d;
+        printf("Opened heap file with %d keys and d=%d\n", selectedHeap->size, d);
+    }
+    else
     {
-        printf("array %d: ", i + 1);
-        printHeap(&heaps[i]);
-    }
-    
-    /*pick array*/
-    selectedHeapIndex = getIntInput("\nSelect an array number (1 to number of heaps): ", 1, numHeaps) - 1;
-    
-    
-    /*get d*/
-    d = getIntInput("Enter the degree (d) of the heap (greater than 1): ", 1, INT_MAX);
-   
-    /*build heap*/
-    selectedHeap = &heaps[selectedHeapIndex];
-    selectedHeap->d = d;
-    buildMaxHeap(selectedHeap);
+        /*only the selected array is parsed*/
+        openHeapIndex(&heapIndex, fileName);
+        if (heapIndex.numHeaps == 0)
+        {
+            fprintf(stderr, "Error: no arrays in %s\n", fileName);
+            exit(EXIT_FAILURE);
+        }
+
+
+        /*print arrays*/
+        printf("Available arrays:\n");
+        for (i = 0; i < heapIndex.numHeaps; i++)
+        {
+            printf("array %d: ", i + 1);
+            printIndexedLine(&heapIndex, i);
+        }
+
+        /*pick array*/
+        selectedHeapIndex = getIntInput("\nSelect an array number (1 to number of heaps): ", 1, heapIndex.numHeaps) - 1;
+
+
+        /*get d*/
+        d = getIntInput("Enter the degree (d) of the heap (greater than 1): ", 1, INT_MAX);
+
+        /*build heap*/
+        selectedHeap = getIndexedHeap(&heapIndex, selectedHeapIndex, d);
+    }
 
     /*start the program*/
     while (1)
     {
+        /*keep the header of a mapped heap file in sync with the keys*/
+        syncHeapFile(selectedHeap);
+
         /*print current heap*/
-        printf("\nYour array with the d=%d is now heaped like this:\n",d);
-        printHeap(selectedHeap);
+        if (printChanged && selectedHeap->changedTo >= 0)
+        {
+            printf("\nYour array with the d=%d changed at indexes %d to %d:\n", d,
+                   selectedHeap->changedFrom, selectedHeap->changedTo);
+            printHeapRange(selectedHeap, selectedHeap->changedFrom, selectedHeap->changedTo + 1);
+        }
+        else if (printTop > 0 && printTop < selectedHeap->size)
+        {
+            printf("\nThe first %d keys (top levels) of your array with the d=%d are:\n", printTop, d);
+            printHeapRange(selectedHeap, 0, printTop);
+        }
+        else
+        {
+            printf("\nYour array with the d=%d is now heaped like this:\n",d);
+            printHeap(selectedHeap);
+        }
+        resetChanges(selectedHeap);
         
         printf("\nChoose an operation:\n");
         printf("1. Insert Key\n");
@@ -363,8 +7553,10 @@ int main(int argc, const char * argv[])
         printf("3. Extract Max\n");
         printf("4. Delete Key\n");
         printf("5. Exit\n");
+        printf("6. Save Heap to Binary File\n");
+        printf("7. Dump Keys to Raw File\n");
         printf("Enter your choice: ");
-        choice = getIntInput("", 1, 5);
+        choice = getIntInput("", 1, 7);
 
         
         switch (choice)
@@ -393,7 +7585,23 @@ int main(int argc, const char * argv[])
                 break;
             case 5:
                 printf("Exiting program.\n");
+                if (isBinary)
+                    freeHeap(&fileHeap);
+                else
+                    closeHeapIndex(&heapIndex);
                 return 0;
+            case 6:
+                printf("Enter the name of the binary file: ");
+                scanf("%s", fileName);
+                saveHeapFile(selectedHeap, fileName);
+                printf("Heap saved to %s\n", fileName);
+                break;
+            case 7:
+                printf("Enter the name of the raw file: ");
+                scanf("%s", fileName);
+                dumpHeapKeys(selectedHeap, fileName);
+                printf("Keys dumped to %s\n", fileName);
+                break;
             default:
                 printf("Invalid choice. Please try again.\n");
         }
@@ -401,4 +7609,3 @@ int main(int argc, const char * argv[])
      
     return 0;
 }
-